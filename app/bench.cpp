@@ -0,0 +1,341 @@
+#include "batch.h"
+#include "chip8.h"
+#include "lockstep.h"
+#include "rewind.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+ * Headless benchmark of the execution backends. Prints one CSV row per
+ * workload and backend, to compare dispatch strategies across builds.
+ * With --verify it checks the backends against the interpreter instead.
+ */
+
+struct Workload {
+    std::string name;
+    // ROM file, or the program itself for the synthetic ones
+    std::string path;
+    std::vector<uint8_t> program;
+};
+
+struct BackendInfo {
+    const char *name;
+    Backend backend;
+};
+
+constexpr BackendInfo backends[] = {
+        {"interpreter", Backend::Interpreter},
+        {"threaded", Backend::Threaded},
+        {"jit", Backend::Jit},
+};
+
+// synthetic opcode mixes, all loop forever
+static std::vector<Workload> synthetic() {
+    return {
+            // 8XYN arithmetic
+            {"synthetic/alu", "", {
+                    0x60, 0x01, 0x61, 0x03,
+                    0x80, 0x14, 0x81, 0x05, 0x82, 0x03, 0x82, 0x16, 0x83, 0x0E,
+                    0x81, 0x21, 0x83, 0x12, 0x84, 0x07, 0x74, 0x01,
+                    0x12, 0x04}},
+            // font sprites all over the screen
+            {"synthetic/draw", "", {
+                    0xA0, 0x50, 0x60, 0x00, 0x61, 0x00,
+                    0xD0, 0x15, 0x70, 0x05, 0xD0, 0x15, 0x71, 0x03,
+                    0x12, 0x06}},
+            // nested subroutines
+            {"synthetic/call", "", {
+                    0x22, 0x06, 0x12, 0x00, 0x00, 0x00,
+                    0x22, 0x0A, 0x00, 0xEE,
+                    0x22, 0x0E, 0x00, 0xEE,
+                    0x70, 0x01, 0x00, 0xEE}},
+            // BCD and register save/restore
+            {"synthetic/memory", "", {
+                    0xA3, 0x00,
+                    0xF6, 0x33, 0xF5, 0x55, 0xF5, 0x65, 0x76, 0x01,
+                    0x12, 0x02}},
+            // BCD at 0x1000 + V3, the XO-CHIP memory above 4 KB (0x000 + V3 in the other profiles)
+            {"synthetic/high-memory", "", {
+                    0xAF, 0x80, 0x6A, 0x80, 0xFA, 0x1E,
+                    0xF3, 0x1E, 0xF3, 0x33, 0xF2, 0x65, 0x73, 0x01,
+                    0x12, 0x00}},
+    };
+}
+
+static bool load(Chip8 &chip, const Workload &workload) {
+    if (workload.program.empty()) {
+        return chip.load_program(workload.path);
+    }
+    return chip.load_program(workload.program.data(), workload.program.size());
+}
+
+static double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) {
+        return 0;
+    }
+    auto index = std::min(values.size() - 1, (size_t) (p * values.size()));
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+static void usage(const char *name) {
+    printf("Usage:\n");
+    printf("  %s [--verify] [--backend interpreter|threaded|jit] [--frames <n>] [--ipf <n>] [--roms <dir>]\n", name);
+}
+
+// frames per workload and profile of --verify unless --frames is given
+constexpr int VERIFY_FRAMES = 300;
+
+constexpr Profile profiles[] = {Profile::CosmacVip, Profile::Chip48, Profile::SuperChip, Profile::Modern, Profile::XoChip};
+
+// changes every few frames, so EX9E, EXA1 and FX0A take both paths
+static uint16_t scripted_keys(int frame) {
+    return (frame / 7) % 2 ? 1 << (frame / 14 % 16) : 0;
+}
+
+// history of the rewind check, enough for every frame
+constexpr size_t VERIFY_REWIND_BYTES = 64 << 20;
+
+// lanes of the lockstep check, a partial AVX2 block
+constexpr int VERIFY_LANES = 12;
+
+// differs per lane, so lanes diverge and regroup
+static uint16_t lane_keys(int lane, int frame) {
+    return (frame / (lane + 1)) % 3 ? 1 << (lane % 16) : 0;
+}
+
+// lockstep lanes (AVX2 and scalar kernels) against one Chip8 per lane in Profile::Modern, false on a mismatch
+static bool verify_lockstep(const Workload &workload, int frames, int instructions_per_frame) {
+    lockstep::Engine engines[2]{lockstep::Engine(VERIFY_LANES), lockstep::Engine(VERIFY_LANES)};
+    engines[1].use_avx2(false);
+    for (auto &engine : engines) {
+        bool loaded = workload.program.empty() ? engine.load_program(workload.path)
+                                               : engine.load_program(workload.program.data(), workload.program.size());
+        if (!loaded) {
+            // larger than the lockstep engine supports, nothing to compare
+            return true;
+        }
+    }
+
+    std::vector<std::unique_ptr<Chip8>> lanes;
+    for (int lane = 0; lane < VERIFY_LANES; ++lane) {
+        auto chip = std::make_unique<Chip8>(TimerMode::Frame);
+        chip->init(true);
+        load(*chip, workload);
+        chip->set_profile(Profile::Modern);
+        // lanes are seeded lane + 1, see lockstep::Engine::load_program()
+        chip->seed(lane + 1);
+        lanes.push_back(std::move(chip));
+    }
+
+    auto extracted = std::make_unique<Chip8>(TimerMode::Frame);
+    extracted->init(true);
+    for (int frame = 0; frame < frames; ++frame) {
+        for (int lane = 0; lane < VERIFY_LANES; ++lane) {
+            lanes[lane]->keys = lane_keys(lane, frame);
+            lanes[lane]->run_frame(instructions_per_frame);
+        }
+        for (auto &engine : engines) {
+            for (int lane = 0; lane < VERIFY_LANES; ++lane) {
+                engine.keys[lane] = lane_keys(lane, frame);
+            }
+            engine.run_frame(instructions_per_frame);
+            // extracting is slow, lanes that diverged stay diverged
+            if (frame % 10 != 9 && frame != frames - 1) {
+                continue;
+            }
+            for (int lane = 0; lane < VERIFY_LANES; ++lane) {
+                engine.extract(lane, *extracted);
+                if (batch::state_hash(*extracted) != batch::state_hash(*lanes[lane])) {
+                    printf("%s,lockstep%s: lane %d differs from Chip8 in frame %d (PC %03X vs %03X)\n",
+                           workload.name.c_str(), engine.avx2() ? "/avx2" : "", lane, frame,
+                           extracted->PC, lanes[lane]->PC);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * Runs every workload in every profile on the interpreter and on the other
+ * backends with the same input, the state hash and instruction count must
+ * agree after every frame. The interpreter frames go through a rewind
+ * buffer and back. Then runs lockstep lanes (with the AVX2 kernels when
+ * available and with the scalar ones) against one scalar Chip8 per lane in
+ * Profile::Modern. Returns the number of mismatches.
+ */
+static int verify(const std::vector<Workload> &workloads, const std::string &selected, int frames, int instructions_per_frame) {
+    int failures = 0;
+    RewindBuffer history(VERIFY_REWIND_BYTES, frames);
+    State state;
+    auto high_memory = std::make_unique<HighMemory>();
+    std::vector<uint64_t> hashes(frames);
+    for (auto &workload : workloads) {
+        for (auto profile : profiles) {
+            auto reference = std::make_unique<Chip8>(TimerMode::Frame);
+            if (!reference->init(true) || !load(*reference, workload)) {
+                fprintf(stderr, "Failed to load %s\n", workload.name.c_str());
+                ++failures;
+                break;
+            }
+            reference->set_profile(profile);
+            history.clear();
+
+            std::vector<std::unique_ptr<Chip8>> chips;
+            std::vector<const char *> names;
+            for (auto &info : backends) {
+                if (info.backend == Backend::Interpreter || (!selected.empty() && selected != info.name)) {
+                    continue;
+                }
+                auto chip = std::make_unique<Chip8>(TimerMode::Frame);
+                if (!chip->set_backend(info.backend)) {
+                    continue;
+                }
+                chip->init(true);
+                load(*chip, workload);
+                chip->set_profile(profile);
+                chips.push_back(std::move(chip));
+                names.push_back(info.name);
+            }
+
+            for (int frame = 0; frame < frames; ++frame) {
+                reference->keys = scripted_keys(frame);
+                auto expected = reference->run_frame(instructions_per_frame);
+                auto hash = batch::state_hash(*reference);
+                hashes[frame] = hash;
+                reference->save_state(state, high_memory.get());
+                history.push(state, high_memory.get());
+                for (size_t i = 0; i < chips.size(); ++i) {
+                    if (!chips[i]) {
+                        continue;
+                    }
+                    chips[i]->keys = scripted_keys(frame);
+                    auto executed = chips[i]->run_frame(instructions_per_frame);
+                    if (executed != expected || batch::state_hash(*chips[i]) != hash) {
+                        printf("%s,%s,profile %d: differs from the interpreter in frame %d (PC %03X vs %03X)\n",
+                               workload.name.c_str(), names[i], (int) profile, frame, chips[i]->PC, reference->PC);
+                        chips[i].reset();
+                        ++failures;
+                    }
+                }
+            }
+
+            // every frame but the last can be restored and hashes like it did
+            for (int frame = frames - 2; frame >= 0; --frame) {
+                if (!history.pop(state, high_memory.get()) || !reference->load_state(state, high_memory.get()) ||
+                    batch::state_hash(*reference) != hashes[frame]) {
+                    printf("%s,rewind,profile %d: frame %d is not restored\n", workload.name.c_str(), (int) profile, frame);
+                    ++failures;
+                    break;
+                }
+            }
+        }
+        if (selected.empty() && !verify_lockstep(workload, frames, instructions_per_frame)) {
+            ++failures;
+        }
+        printf("%s verified\n", workload.name.c_str());
+    }
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    std::string roms("../roms");
+    // 0 - 2000, VERIFY_FRAMES with --verify
+    int frames = 0;
+    int instructions_per_frame = 1000;
+    // empty - all available backends
+    std::string selected;
+    bool check = false;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--verify")) {
+            check = true;
+        } else if (!strcmp(argv[i], "--backend") && i + 1 < argc) {
+            selected = argv[++i];
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--ipf") && i + 1 < argc) {
+            instructions_per_frame = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--roms") && i + 1 < argc) {
+            roms = argv[++i];
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<Workload> workloads;
+    std::error_code error;
+    for (auto &entry : std::filesystem::directory_iterator(roms, error)) {
+        if (entry.is_regular_file()) {
+            workloads.push_back({entry.path().filename().string(), entry.path().string(), {}});
+        }
+    }
+    std::sort(workloads.begin(), workloads.end(), [](const Workload &a, const Workload &b) { return a.name < b.name; });
+    if (error) {
+        fprintf(stderr, "Failed to list %s, running the synthetic workloads only\n", roms.c_str());
+    }
+    for (auto &workload : synthetic()) {
+        workloads.push_back(workload);
+    }
+
+    if (check) {
+        int failures = verify(workloads, selected, frames ? frames : VERIFY_FRAMES, instructions_per_frame);
+        printf("%d mismatches\n", failures);
+        return failures ? 1 : 0;
+    }
+    if (!frames) {
+        frames = 2000;
+    }
+
+    printf("workload,backend,frames,instructions,seconds,instructions_per_second,ns_per_instruction,frame_p50_us,frame_p99_us\n");
+    for (auto &info : backends) {
+        if (!selected.empty() && selected != info.name) {
+            continue;
+        }
+        for (auto &workload : workloads) {
+            // NOTE: large, keep it off the stack
+            auto chip = std::make_unique<Chip8>(TimerMode::Frame);
+            if (!chip->set_backend(info.backend)) {
+                fprintf(stderr, "Backend %s is not available on this host\n", info.name);
+                break;
+            }
+            // the idle loops many ROMs end in are part of the workload
+            chip->skip_idle = false;
+            if (!chip->init(true) || !load(*chip, workload)) {
+                fprintf(stderr, "Failed to load %s\n", workload.name.c_str());
+                continue;
+            }
+
+            std::vector<double> frame_us;
+            frame_us.reserve(frames);
+            uint64_t executed = 0;
+            auto start = std::chrono::steady_clock::now();
+            auto previous = start;
+            for (int frame = 0; frame < frames && !chip->shutdown; ++frame) {
+                executed += chip->run_frame(instructions_per_frame);
+                auto now = std::chrono::steady_clock::now();
+                frame_us.push_back(std::chrono::duration<double, std::micro>(now - previous).count());
+                previous = now;
+            }
+            double seconds = std::chrono::duration<double>(previous - start).count();
+
+            printf("%s,%s,%zu,%llu,%.6f,%.0f,%.3f,%.3f,%.3f\n",
+                   workload.name.c_str(), info.name, frame_us.size(), (unsigned long long) executed, seconds,
+                   executed / seconds, seconds * 1e9 / std::max<uint64_t>(1, executed),
+                   percentile(frame_us, 0.50), percentile(frame_us, 0.99));
+        }
+    }
+
+    return 0;
+}
@@ -1,41 +1,230 @@
+#include "audio.h"
+#include "batch.h"
 #include "chip8.h"
+#include "input.h"
+#include "pacer.h"
+#include "rewind.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdio>
-#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
 
 
+static void usage(const char *name) {
+    printf("Usage:\n");
+    printf("  %s [--headless] [--threaded | --jit] [--ipf <n>] [--fps <n>] [--timer-thread] [--cycles <n>] [--rewind <s>]\n", name);
+    printf("  %*s [--seed <n>] [--record <file> | --replay <file>] [--quirks vip|chip48|schip|modern|xochip] [rom]\n",
+           (int) strlen(name), "");
+}
+
+// history memory, typically enough for well over 10 minutes
+constexpr size_t REWIND_BYTES = 8 << 20;
+#ifdef CHIP8_PROFILE
+// flamegraph.pl / speedscope input
+constexpr const char *PROFILE_PATH = "chip8.folded";
+#endif
+// held to step back in time
+constexpr SDL_Scancode REWIND_KEY = SDL_SCANCODE_BACKSPACE;
+
+static bool parse_profile(const char *name, Profile &profile) {
+    const struct {
+        const char *name;
+        Profile profile;
+    } profiles[] = {
+            {"vip", Profile::CosmacVip},
+            {"chip48", Profile::Chip48},
+            {"schip", Profile::SuperChip},
+            {"modern", Profile::Modern},
+            {"xochip", Profile::XoChip},
+    };
+    for (auto &entry : profiles) {
+        if (!strcmp(name, entry.name)) {
+            profile = entry.profile;
+            return true;
+        }
+    }
+    return false;
+}
+
 int main(int argc, char **argv) {
-//    if (argc != 2) {
-//        printf("Usage:\n");
-//        printf("  %s <rom>\n", argv[0]);
-//        return 1;
-//    }
-
-    Chip8 chip;
-//    std::string program(argv[1]);
 //    std::string program("../roms/IBM_Logo.ch8");
 //    std::string program("../roms/BC_test.ch8");
     std::string program("../roms/SCTEST");
+    bool headless = false;
+    Backend backend = Backend::Interpreter;
+    // 0 - run until the program shuts down
+    unsigned long long cycles = 0;
+    int instructions_per_frame = INSTRUCTIONS_PER_FRAME;
+    TimerMode timer_mode = TimerMode::Frame;
+    // present every n-th frame
+    int present_interval = 1;
+    // seconds of rewind history, 0 - disabled
+    int rewind_seconds = 600;
+    uint32_t seed = DEFAULT_SEED;
+    std::string record;
+    std::string replay;
+    // guessed from the program unless set
+    bool quirks = false;
+    Profile profile = Profile::Modern;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--headless")) {
+            headless = true;
+        } else if (!strcmp(argv[i], "--threaded")) {
+            backend = Backend::Threaded;
+        } else if (!strcmp(argv[i], "--jit")) {
+            backend = Backend::Jit;
+        } else if (!strcmp(argv[i], "--ipf") && i + 1 < argc) {
+            instructions_per_frame = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--fps") && i + 1 < argc) {
+            present_interval = std::max(1, 60 / std::max(1, atoi(argv[++i])));
+        } else if (!strcmp(argv[i], "--timer-thread")) {
+            timer_mode = TimerMode::Thread;
+        } else if (!strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            cycles = strtoull(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--rewind") && i + 1 < argc) {
+            rewind_seconds = std::max(0, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+            seed = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            record = argv[++i];
+        } else if (!strcmp(argv[i], "--replay") && i + 1 < argc) {
+            replay = argv[++i];
+        } else if (!strcmp(argv[i], "--quirks") && i + 1 < argc && parse_profile(argv[i + 1], profile)) {
+            quirks = true;
+            ++i;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            program = argv[i];
+        }
+    }
+
+    input::Log log;
+    if (!replay.empty()) {
+        if (!log.load(replay)) {
+            printf("Failed to load input log: %s\n", replay.c_str());
+            return 1;
+        }
+        // the session runs exactly as recorded
+        seed = log.seed;
+        instructions_per_frame = log.instructions_per_frame;
+        timer_mode = TimerMode::Frame;
+    }
+    log.seed = seed;
+    log.instructions_per_frame = instructions_per_frame;
+    input::Player player(log.events);
+    if (!record.empty() || !replay.empty()) {
+        // a rewound session can not be recorded frame by frame
+        rewind_seconds = 0;
+    }
+
+    Chip8 chip(timer_mode);
+    chip.seed(seed);
+    if (!chip.set_backend(backend)) {
+        printf("Selected backend is not available on this host\n");
+        return 1;
+    }
 
     if (!chip.load_program(program)) {
         printf("Failed to load program: %s\n", program.c_str());
         return 1;
     }
+    if (quirks) {
+        chip.set_profile(profile);
+    }
 
-    if (!chip.init()) {
+    if (!chip.init(headless)) {
         printf("Failed to initialize CHIP8\n");
         return 1;
     }
+    audio::Beeper beeper;
+    if (!headless) {
+        if (beeper.init()) {
+            chip.beeper = &beeper;
+        } else {
+            printf("No audio device, running without sound\n");
+        }
+    }
 
-    while (!chip.shutdown) {
-        chip.fetch_decode_execute();
-//        SDL_Delay(2); // 700 instructions should be 1,42 ms
-        usleep(1400);
+    auto start = std::chrono::steady_clock::now();
+    FramePacer pacer;
+    RewindBuffer history(rewind_seconds ? REWIND_BYTES : 0, rewind_seconds * 60);
+    State state;
+    HighMemory high_memory;
+    input::Keypad keypad;
+    bool closed = false;
+    unsigned long long executed = 0;
+    for (uint64_t frame = 0; !chip.shutdown && (!cycles || executed < cycles); ++frame) {
+        if (!replay.empty() && frame >= log.frames) {
+            break;
+        }
+        // the window is pumped even when replaying
+        if (!headless && !keypad.pump()) {
+            closed = true;
+            break;
+        }
+        chip.keys = replay.empty() ? keypad.keys() : player.keys(frame);
+        if (!record.empty()) {
+            log.record(chip.keys);
+        }
+        // headless runs as fast as the host allows
+        if (headless) {
+            executed += chip.run_frame(cycles ? std::min<unsigned long long>(instructions_per_frame, cycles - executed) : instructions_per_frame);
+            if (chip.key_wait.waiting() && player.finished()) {
+                printf("Program waits for a key (FX0A), no more input\n");
+                break;
+            }
+            if (chip.stuck()) {
+                printf("Program stopped in a self-jump\n");
+                break;
+            }
+            continue;
+        }
+        if (rewind_seconds && SDL_GetKeyboardState(nullptr)[REWIND_KEY]) {
+            // one frame back per frame, stays at the oldest one
+            if (history.pop(state, &high_memory)) {
+                chip.load_state(state, &high_memory);
+            }
+        } else {
+            executed += chip.run_frame(instructions_per_frame);
+            if (rewind_seconds) {
+                chip.save_state(state, &high_memory);
+                history.push(state, &high_memory);
+            }
+        }
+        if (pacer.frames % present_interval == 0) {
+            chip.display.present();
+        }
+        pacer.wait();
     }
 
-    SDL_Delay(5000);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("Executed %llu instructions in %.3f s (%.0f instructions/s)\n",
+           executed, elapsed.count(), executed / elapsed.count());
+    if (!replay.empty()) {
+        printf("State hash %016llx\n", (unsigned long long) batch::state_hash(chip));
+    }
+    if (!record.empty() && !log.save(record)) {
+        printf("Failed to save input log: %s\n", record.c_str());
+    }
+#ifdef CHIP8_PROFILE
+    chip.profiling.report(stdout, chip.display.draw_time);
+    if (chip.profiling.write_folded(PROFILE_PATH)) {
+        printf("Folded call stacks written to %s\n", PROFILE_PATH);
+    }
+#endif
+    if (!headless) {
+        printf("Target %d instructions/s, %.2f frames/s\n",
+               (int) (instructions_per_frame / std::chrono::duration<double>(pacer.period).count()), pacer.rate());
+        if (!closed) {
+            SDL_Delay(5000);
+        }
+    }
 
 
     return 0;
 }
-
@@ -0,0 +1,99 @@
+#ifndef CHIP8_EMULATOR_AUDIO_H
+#define CHIP8_EMULATOR_AUDIO_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <SDL.h>
+
+namespace audio {
+    /*
+     * Lock free queue between exactly one producer and one consumer thread.
+     * N must be a power of two, the indices only ever grow.
+     */
+    template<typename T, size_t N>
+    struct Ring {
+        static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+        // producer only, false if full
+        bool push(const T &value) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == N) {
+                return false;
+            }
+            _items[tail & (N - 1)] = value;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer only, false if empty
+        bool pop(T &value) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire)) {
+                return false;
+            }
+            value = _items[head & (N - 1)];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+    private:
+        T _items[N]{};
+        // on separate cache lines, each is written by one side only
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+    };
+
+    struct Event {
+        enum class Kind : uint8_t {
+            // play for 'ticks' 60 Hz sound timer ticks, 0 stops
+            Tone,
+            // XO-CHIP 1 bit samples (F002), replace the square wave
+            Pattern
+        };
+
+        Kind kind{Kind::Tone};
+        uint8_t ticks{0};
+        uint8_t pattern[16]{0};
+    };
+
+    /*
+     * Sound timer output on the SDL audio callback. The emulation thread
+     * publishes events when the program sets the sound timer (FX18) or loads
+     * a pattern (F002), the callback drains them at the start of every
+     * buffer and counts the tone down itself. Neither side waits for the
+     * other, a tone starts at most one buffer after FX18.
+     */
+    struct Beeper {
+        static constexpr int SAMPLE_RATE = 48000;
+        // ~10.7 ms
+        static constexpr int BUFFER_SAMPLES = 512;
+        static constexpr int TONE_HZ = 440;
+        // XO-CHIP default pitch
+        static constexpr int PATTERN_HZ = 4000;
+
+        ~Beeper();
+
+        // false if no audio device can be opened
+        bool init();
+        // emulation thread only
+        void tone(uint8_t ticks);
+        void pattern(const uint8_t *pattern);
+
+    private:
+        static void callback(void *userdata, Uint8 *stream, int len);
+        void fill(int16_t *samples, int count);
+
+        SDL_AudioDeviceID _device{0};
+        // NOTE: a full ring drops the event, 64 are far more than a buffer's worth of FX18/F002
+        Ring<Event, 64> _events;
+
+        /* audio thread only */
+        uint32_t _remaining{0};
+        uint32_t _phase{0};
+        bool _use_pattern{false};
+        uint8_t _pattern[16]{0};
+    };
+}
+
+#endif//CHIP8_EMULATOR_AUDIO_H
@@ -0,0 +1,53 @@
+#ifndef CHIP8_EMULATOR_BATCH_H
+#define CHIP8_EMULATOR_BATCH_H
+
+#include "chip8.h"
+#include "input.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace batch {
+    using KeyEvent = input::KeyEvent;
+
+    struct Job {
+        std::string rom;
+        // the program itself, used instead of 'rom' when not empty
+        std::vector<uint8_t> program{};
+        // instructions to execute, runs shorter if the program shuts down or stops (Chip8::stuck())
+        uint64_t cycles{0};
+        // sorted by frame
+        std::vector<KeyEvent> input{};
+        int instructions_per_frame{INSTRUCTIONS_PER_FRAME};
+        uint32_t seed{DEFAULT_SEED};
+    };
+
+    struct Result {
+        // false if the ROM could not be loaded
+        bool ok{false};
+        uint64_t executed{0};
+        uint64_t state_hash{0};
+        uint64_t rows[display::Display::PLANES][display::Display::MAX_HEIGHT][display::Display::ROW_WORDS]{};
+    };
+
+    /*
+     * FNV-1a over the machine state: memory (with XO-CHIP memory above 4 KB),
+     * registers, stack, timers, random number generator, FX0A wait, audio
+     * pattern, resolution, selected planes and framebuffer
+     */
+    uint64_t state_hash(const Chip8 &chip);
+
+    // runs a single job on a fresh headless instance
+    Result run(const Job &job, rom::Cache *cache = nullptr);
+
+    /*
+     * Runs the jobs on a fixed pool of worker threads, one headless Chip8 per
+     * job, results are in the order of the jobs. Programs are analyzed once
+     * per batch, see rom::Cache.
+     * workers == 0 - one worker per hardware thread
+     */
+    std::vector<Result> run(const std::vector<Job> &jobs, unsigned workers = 0);
+}
+
+#endif//CHIP8_EMULATOR_BATCH_H
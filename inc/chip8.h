@@ -2,14 +2,28 @@
 #define CHIP8_EMULATOR_CHIP8_H
 
 #include "display.h"
+#include "profiler.h"
 
 #include <atomic>
 #include <cstdint>
-#include <mutex>
+#include <memory>
+#include <string>
 #include <thread>
 
+// low resolution, SUPER-CHIP programs can switch to display::Display::MAX_WIDTH x MAX_HEIGHT
 constexpr int DISPLAY_WIDTH = 64;
 constexpr int DISPLAY_HEIGHT = 32;
+// FX29/FX30 font addresses, below PROGRAM_START
+constexpr int FONT_START = 0x50;
+constexpr int BIG_FONT_START = 0xA0;
+// programs are loaded at 0x200, up to the end of memory
+constexpr int PROGRAM_START = 0x200;
+constexpr int MAX_PROGRAM_SIZE = 4096 - PROGRAM_START;
+// XO-CHIP addresses are 16 bit, the memory above 4 KB exists for Profile::XoChip only
+constexpr int XO_MEMORY_SIZE = 0x10000;
+constexpr int MAX_XO_PROGRAM_SIZE = XO_MEMORY_SIZE - PROGRAM_START;
+// ~700 instructions per second at 60 frames per second
+constexpr int INSTRUCTIONS_PER_FRAME = 12;
 
 constexpr SDL_Scancode scancodes[] = {
         SDL_SCANCODE_X,
@@ -39,41 +53,230 @@ struct Stack {
     int index{0};
 };
 
+// NOTE: relaxed atomics, get() and set() are plain loads and stores
 struct Timer {
     void decr();
-    uint8_t get();
-    void set(uint8_t value);
+    uint8_t get() const { return _value.load(std::memory_order_relaxed); }
+    void set(uint8_t value) { _value.store(value, std::memory_order_relaxed); }
 
 private:
-    uint8_t _value;
-    std::mutex _mutex;
+    std::atomic<uint8_t> _value{0};
 };
 
+// xorshift PRNG state must not be 0
+constexpr uint32_t DEFAULT_SEED = 1;
+
+inline uint32_t xorshift32(uint32_t &state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
 struct Instruction {
+    Instruction() = default;
     // FIXME: is the order right or should it be reversed?
-    Instruction(uint8_t b0, uint8_t b1) : value((b0 << 8) | b1) {}
+    constexpr Instruction(uint8_t b0, uint8_t b1)
+        : value((b0 << 8) | b1), nnn(((b0 & 0x0F) << 8) | b1), x(b0 & 0x0F), y(b1 >> 4), n(b1 & 0x0F), nn(b1) {}
 
-    uint16_t N() const { return (value & 0x000F); }
-    uint16_t NN() const { return (value & 0x00FF); }
-    uint16_t NNN() const { return (value & 0x0FFF); }
-    uint16_t X() const { return ((value >> 8) & 0x0F); }
-    uint16_t Y() const { return ((value >> 4) & 0x0F); }
-    uint16_t FN() const { return ((value >> 12) & 0x0F); }
+    // operands are extracted once on construction, accessors are plain loads
+    constexpr uint16_t N() const { return n; }
+    constexpr uint16_t NN() const { return nn; }
+    constexpr uint16_t NNN() const { return nnn; }
+    constexpr uint16_t X() const { return x; }
+    constexpr uint16_t Y() const { return y; }
+    constexpr uint16_t FN() const { return ((value >> 12) & 0x0F); }
 
     uint16_t value{0};
+    uint16_t nnn{0};
+    uint8_t x{0};
+    uint8_t y{0};
+    uint8_t n{0};
+    uint8_t nn{0};
+};
+
+struct Chip8;
+namespace jit {
+    struct Jit;
+}
+namespace rom {
+    struct Cache;
+}
+namespace audio {
+    struct Beeper;
+}
+using OpHandler = void (Chip8::*)(Instruction);
+
+struct DecodedOp {
+    // nullptr - not decoded yet (or invalidated by a memory write)
+    OpHandler handler{nullptr};
+    // handler label of the threaded interpreter, resolved on first use
+    void *label{nullptr};
+    Instruction instruction;
+};
+
+/*
+ * FX0A in progress. The core is suspended until a key is pressed and then
+ * released, keys already down when FX0A starts have to be released first.
+ */
+struct KeyWait {
+    // waits for the key stored in V[x]
+    void start(uint8_t x, uint16_t keys);
+    // the lowest key released since start(), -1 if none yet
+    int released(uint16_t keys);
+    bool waiting() const { return x >= 0; }
+
+    // -1 - not waiting
+    int8_t x{-1};
+    // down when FX0A started, ignored until released
+    uint16_t ignored{0};
+    // pressed since
+    uint16_t pressed{0};
+};
+
+/*
+ * Snapshot of a Chip8, see Chip8::save_state(). Trivially copyable, it can be
+ * stored in a ring buffer or written to a file as is. XO-CHIP memory above
+ * 4 KB goes into a separate HighMemory, the other profiles do not need it.
+ */
+struct State {
+    static constexpr uint32_t VERSION = 7;
+
+    uint32_t version{VERSION};
+    uint16_t PC{0};
+    uint16_t I{0};
+    uint8_t V[16]{0};
+    uint16_t stack[16]{0};
+    uint8_t stack_index{0};
+    uint8_t delay_timer{0};
+    uint8_t sound_timer{0};
+    uint32_t rng{DEFAULT_SEED};
+    uint8_t memory[4096]{0};
+    // the XO-CHIP memory above 4 KB was saved into a HighMemory
+    bool high_memory{false};
+    // current resolution
+    uint16_t width{DISPLAY_WIDTH};
+    uint16_t height{DISPLAY_HEIGHT};
+    // bitplanes selected by FN01
+    uint8_t selected{1};
+    uint8_t audio_pattern[16]{0};
+    KeyWait key_wait{};
+    // packed framebuffer, see display::Display::rows
+    uint64_t rows[display::Display::PLANES][display::Display::MAX_HEIGHT][display::Display::ROW_WORDS]{};
+};
+
+// XO-CHIP memory from 0x1000 up, saved next to a State
+struct HighMemory {
+    uint8_t bytes[XO_MEMORY_SIZE - 4096]{0};
 };
 
 /*
- * TODO:
- * Configurable instruction speed
+ * Instructions CHIP-8 implementations disagree on:
+ *              8XY6/8XYE        BNNN             FX55/FX65        SUPER-CHIP 128x64    XO-CHIP
+ * CosmacVip    VX = VY first    NNN + V0         I += X + 1       no                   no
+ * Chip48       VX only          XNN + VX         I += X           no                   no
+ * SuperChip    VX only          XNN + VX         I unchanged      yes                  no
+ * Modern       VX only          NNN + V0         I unchanged      no                   no
+ * XoChip       VX only          NNN + V0         I += X + 1       yes                  yes
  */
+enum class Profile {
+    CosmacVip,
+    Chip48,
+    SuperChip,
+    Modern,
+    XoChip
+};
+
+struct Quirks {
+    enum class Index : uint8_t {
+        Unchanged,
+        PlusX,
+        PlusX1
+    };
+
+    // 8XY6/8XYE shift VY into VX
+    bool shift_vy;
+    // BXNN jumps to XNN + VX
+    bool jump_vx;
+    // how FX55/FX65 leave I
+    Index load_store;
+    // 00CN, 00FB-00FF, DXY0 and FX30 are decoded
+    bool hires;
+    /*
+     * 16 bit addresses (F000 NNNN, I is not clipped to 12 bits), 5XY2/5XY3,
+     * 00DN, FN01 bitplanes that sprites wrap around, F002
+     */
+    bool xo;
+};
+
+constexpr Quirks quirks_of(Profile profile) {
+    switch (profile) {
+        case Profile::CosmacVip: return {true, false, Quirks::Index::PlusX1, false, false};
+        case Profile::Chip48: return {false, true, Quirks::Index::PlusX, false, false};
+        case Profile::SuperChip: return {false, true, Quirks::Index::Unchanged, true, false};
+        case Profile::XoChip: return {false, false, Quirks::Index::PlusX1, true, true};
+        default: return {false, false, Quirks::Index::Unchanged, false, false};
+    }
+}
+
+enum class TimerMode {
+    // timers tick once per run_frame(), runs are reproducible
+    Frame,
+    // timers tick at 60 Hz on a separate thread
+    Thread
+};
+
+enum class Backend {
+    Interpreter,
+    // computed goto dispatch, GCC/Clang only
+    Threaded,
+    Jit
+};
+
 struct Chip8 {
-    Chip8();
+    explicit Chip8(TimerMode timer_mode = TimerMode::Frame);
     ~Chip8();
 
-    bool init();
-    bool load_program(const std::string &path);
+    bool init(bool headless = false);
+    /*
+     * false if the file can not be read or is larger than MAX_PROGRAM_SIZE.
+     * The program is analyzed (code map, quirk profile) and its code
+     * pre-decoded, with a cache this happens once per distinct program.
+     */
+    bool load_program(const std::string &path, rom::Cache *cache = nullptr);
+    // copies a program held in memory
+    bool load_program(const uint8_t *program, size_t size, rom::Cache *cache = nullptr);
+    // overrides the profile guessed by load_program()
+    void set_profile(Profile profile);
+    Profile profile() const { return _profile; }
     void fetch_decode_execute();
+    // returns false if the backend is not available on this host
+    bool set_backend(Backend backend);
+    /*
+     * executes up to 'cycles' instructions, returns how many were executed.
+     * Stops after FX0A, later calls return 0 until the key is released.
+     * An idle loop (see skip_idle) is advanced past all of them at once.
+     */
+    uint64_t run(uint64_t cycles);
+    // executes one 60 Hz frame worth of instructions, then ticks the timers in TimerMode::Frame
+    uint64_t run_frame(int instructions_per_frame = INSTRUCTIONS_PER_FRAME);
+    void tick_timers();
+    // PC is a 1NNN jumping to itself and both timers are 0, nothing can change any more
+    bool stuck() const;
+    // must be called after writing to memory from outside the core
+    void invalidate(uint16_t address, uint16_t length);
+    // seeds the CXNN random number generator, 0 selects DEFAULT_SEED
+    void seed(uint32_t value);
+    uint32_t rng() const { return _rng; }
+    // XO-CHIP memory from 0x1000 up, nullptr until the XO-CHIP profile is selected
+    const uint8_t *high_memory() const { return _high_memory.get(); }
+    /*
+     * copies the machine state (not keys or backend settings) into 'state',
+     * in Profile::XoChip the memory above 4 KB into 'high_memory' if given
+     */
+    void save_state(State &state, HighMemory *high_memory = nullptr) const;
+    // returns false if 'state' was saved by an incompatible version or needs 'high_memory'
+    bool load_state(const State &state, const HighMemory *high_memory = nullptr);
 
     uint8_t memory[4096]{0};
     display::Display display;
@@ -86,30 +289,179 @@ struct Chip8 {
 
     /* internal registers */
     uint8_t V[16]{0};
+    // keypad state, bit n set - key n is down (see scancodes), written by the frame loop
+    std::atomic<uint16_t> keys{0};
+    // run() executes nothing while FX0A waits
+    KeyWait key_wait;
+    // XO-CHIP 1 bit samples loaded by F002, played MSB first
+    uint8_t audio_pattern[16]{0};
     std::atomic<int> shutdown{0};
+    // told about FX18 and F002 when set, from the thread running the core
+    audio::Beeper *beeper{nullptr};
+    /*
+     * run() does not execute idle loops: a 1NNN jumping to itself or, in
+     * TimerMode::Frame, FX07, 3XNN, 1NNN polling the delay timer. There the
+     * timer only changes between frames, so the result is the same as
+     * executing them. Off to measure the backends themselves, and in a
+     * CHIP8_PROFILE build, where the profiler counts every instruction.
+     */
+#ifdef CHIP8_PROFILE
+    bool skip_idle{false};
+    profiler::Profiler profiling;
+#else
+    bool skip_idle{true};
+#endif
 
 private:
+    friend struct jit::Jit;
+    template<Profile P>
+    friend struct Dispatch;
+
     void init_font();
+    // copies what is above 4 KB of an XO-CHIP program, 'program' may be the copy in memory
+    void program_loaded(const uint8_t *program, size_t size, rom::Cache *cache);
+    // true if the next 'cycles' instructions only spin in an idle loop, PC and VX are advanced past them
+    bool skip_idle_loop(uint64_t cycles);
     Instruction fetch();
+    OpHandler decode(Instruction instruction);
     void decode_execute(Instruction instruction);
-    void op_0RRR(Instruction instruction);
-    void op_1NNN(Instruction instruction);
-    void op_6XNN(Instruction instruction);
-    void op_7XNN(Instruction instruction);
-    void op_ANNN(Instruction instruction);
-    void op_DXYN(Instruction instruction);
+    DecodedOp predecode(uint16_t address);
+    template<Profile P>
+    void select_profile();
+    template<Profile P>
+    uint64_t run_threaded(uint64_t cycles);
 
-    std::thread _timer_thread;
+    /*
+     * R selects the register operands: compile time constants for the
+     * dispatch table, read from the instruction for the threaded interpreter.
+     * P selects the quirks of the instructions that differ between profiles.
+     */
+    void op_00E0(Instruction instruction);
+    void op_00EE(Instruction instruction);
+    void op_0NNN(Instruction instruction);
+    void op_00CN(Instruction instruction);
+    void op_00FB(Instruction instruction);
+    void op_00FC(Instruction instruction);
+    void op_00FD(Instruction instruction);
+    void op_00FE(Instruction instruction);
+    void op_00FF(Instruction instruction);
+    void op_00DN(Instruction instruction);
+    void op_1NNN(Instruction instruction);
     void op_2NNN(Instruction instruction);
+    template<Profile P, typename R>
     void op_3XNN(Instruction instruction);
+    template<Profile P, typename R>
     void op_4XNN(Instruction instruction);
+    template<Profile P, typename R>
     void op_5XY0(Instruction instruction);
+    template<typename R>
+    void op_5XY2(Instruction instruction);
+    template<typename R>
+    void op_5XY3(Instruction instruction);
+    template<typename R>
+    void op_6XNN(Instruction instruction);
+    template<typename R>
+    void op_7XNN(Instruction instruction);
+    template<typename R>
+    void op_8XY0(Instruction instruction);
+    template<typename R>
+    void op_8XY1(Instruction instruction);
+    template<typename R>
+    void op_8XY2(Instruction instruction);
+    template<typename R>
+    void op_8XY3(Instruction instruction);
+    template<typename R>
+    void op_8XY4(Instruction instruction);
+    template<typename R>
+    void op_8XY5(Instruction instruction);
+    template<Profile P, typename R>
+    void op_8XY6(Instruction instruction);
+    template<typename R>
+    void op_8XY7(Instruction instruction);
+    template<Profile P, typename R>
+    void op_8XYE(Instruction instruction);
+    template<Profile P, typename R>
     void op_9XY0(Instruction instruction);
-    void op_8XYR(Instruction instruction);
+    void op_ANNN(Instruction instruction);
+    template<Profile P>
     void op_BNNN(Instruction instruction);
+    template<typename R>
     void op_CXNN(Instruction instruction);
-    void op_EXRR(Instruction instruction);
-    void op_FXRR(Instruction instruction);
+    template<Profile P, typename R>
+    void op_DXYN(Instruction instruction);
+    template<Profile P, typename R>
+    void op_DXY0(Instruction instruction);
+    template<Profile P, typename R>
+    void op_EX9E(Instruction instruction);
+    template<Profile P, typename R>
+    void op_EXA1(Instruction instruction);
+    template<typename R>
+    void op_FX07(Instruction instruction);
+    void op_FX0A(Instruction instruction);
+    template<typename R>
+    void op_FX15(Instruction instruction);
+    template<typename R>
+    void op_FX18(Instruction instruction);
+    template<Profile P, typename R>
+    void op_FX1E(Instruction instruction);
+    template<typename R>
+    void op_FX29(Instruction instruction);
+    template<typename R>
+    void op_FX30(Instruction instruction);
+    template<Profile P, typename R>
+    void op_FX33(Instruction instruction);
+    template<Profile P, typename R>
+    void op_FX55(Instruction instruction);
+    template<Profile P, typename R>
+    void op_FX65(Instruction instruction);
+    void op_F000(Instruction instruction);
+    void op_FN01(Instruction instruction);
+    void op_F002(Instruction instruction);
+    void op_unknown(Instruction instruction);
+    // FX55/FX65 quirk
+    template<Profile P>
+    void advance_index(int x);
+    // PC += 2, XO-CHIP skips F000 NNNN as a whole
+    template<Profile P>
+    void skip_next();
+    // XO-CHIP DXYN/DXY0, one sprite per selected plane
+    void draw_planes(int x, int y, int height, bool wide);
+
+    // invalidate() after a core write through ram<P>(), the range wraps the same way
+    template<Profile P>
+    void invalidate_ram(uint32_t address, uint32_t length);
+    // byte at a 12 bit (16 bit for XO-CHIP) address
+    template<Profile P>
+    uint8_t &ram(uint32_t address) {
+        if constexpr (quirks_of(P).xo) {
+            address &= XO_MEMORY_SIZE - 1;
+            return address < 4096 ? memory[address] : _high_memory[address - 4096];
+        } else {
+            return memory[address & 0xFFF];
+        }
+    }
+
+    /* pre-decoded instructions, indexed by (even) address / 2 */
+    DecodedOp _decoded[4096 / 2];
+
+    /*
+     * Every profile has its own decoder and threaded interpreter, selected
+     * by set_profile(), so no instruction tests the quirks.
+     */
+    Profile _profile{Profile::Modern};
+    OpHandler (*_quirk_handler)(uint16_t value){nullptr};
+    uint64_t (Chip8::*_run_threaded)(uint64_t cycles){nullptr};
+
+    // CXNN random number generator
+    uint32_t _rng{DEFAULT_SEED};
+    // XO-CHIP memory from 0x1000 up, allocated when the profile is selected
+    std::unique_ptr<uint8_t[]> _high_memory;
+
+    TimerMode _timer_mode;
+    Backend _backend{Backend::Interpreter};
+    std::unique_ptr<jit::Jit> _jit;
+
+    std::thread _timer_thread;
 };
 
 void timer_fnc(Chip8 *chip);
@@ -1,43 +1,120 @@
 #ifndef CHIP8_EMULATOR_DISPLAY_H
 #define CHIP8_EMULATOR_DISPLAY_H
 
+#include "profiler.h"
+
 #include <cstdint>
 #include <cstring>
-#include <vector>
 #include <SDL.h>
 
 namespace display {
-    struct Pixel {
-        bool is_on() const { return r; }
-        void set_on() { r = g = b = 255; }
-        void set_off() { r = g = b = 0; }
-        void toggle() { if (r) r = g = b = 0; else r = g = b = 255; }
-
-        uint8_t r {0};
-        uint8_t g {0};
-        uint8_t b {0};
-    };
-
     struct Screen {
         void clean_up();
 
         SDL_Window *window {nullptr};
         SDL_Renderer *renderer {nullptr};
         SDL_Texture *texture {nullptr};
+        // gray levels of the bitplane colors in the texture format, see Display::color()
+        uint32_t palette[4] {0};
     };
 
+    /*
+     * 1 bit per pixel framebuffer, two 64 bit words per row with the leftmost
+     * pixel in the most significant bit of the first one. At 64x32 only the
+     * first word of the first 32 rows is used. XO-CHIP draws on a second
+     * plane of the same layout. Rows changed since the last present() are
+     * marked in 'dirty', draw() expands only those into the texture.
+     */
     struct Display {
+        static constexpr int MAX_WIDTH = 128;
+        static constexpr int MAX_HEIGHT = 64;
+        static constexpr int ROW_WORDS = MAX_WIDTH / 64;
+        static constexpr int PLANES = 2;
+        // one dirty bit per row
+        static constexpr uint64_t ALL_ROWS = ~0ull;
+        static_assert(MAX_HEIGHT == 64, "dirty rows are tracked in a 64 bit mask");
+
         explicit Display(int w, int h);
         ~Display();
 
-        bool init();
+        // headless: keep the framebuffer in memory only, never touch SDL
+        bool init(bool headless = false);
+        // draws the frame if anything changed since the last present()
+        void present();
+        // copies the dirty rows into the texture and renders it
         void draw();
+        // marks rows y to y + n - 1 as changed, y + n <= MAX_HEIGHT
+        void touch(int y, int n) { dirty |= (n < 64 ? (1ull << n) - 1 : ALL_ROWS) << y; }
+        // clears the selected planes
         void clear();
+        // switches the resolution (SUPER-CHIP 00FE/00FF) and clears all planes
+        void resize(int w, int h);
+        // scrolling moves the selected planes, whole rows are moved and the pixels scrolled in are off
+        void scroll_down(int n);
+        void scroll_up(int n);
+        // 0 < n < 64, pixels are shifted across the words of a row
+        void scroll_right(int n);
+        void scroll_left(int n);
+        bool lit(int plane, int x, int y) const { return (rows[plane][y][x >> 6] >> (63 - (x & 63))) & 1; }
+        // set in any plane
+        bool pixel(int x, int y) const { return color(x, y) != 0; }
+        // bit n set - set in plane n
+        int color(int x, int y) const { return lit(0, x, y) | (lit(1, x, y) << 1); }
+
+        /*
+         * XORs a sprite row, left aligned in 'bits', onto row y at column x.
+         * Pixels past the right edge are clipped, returns non-zero if any
+         * pixel was turned off.
+         */
+        uint64_t blit(int plane, int y, int x, uint64_t bits) {
+            uint64_t *row = rows[plane][y];
+            if (x < 64) {
+                uint64_t collision = row[0] & (bits >> x);
+                row[0] ^= bits >> x;
+                if (x && width > 64) {
+                    collision |= row[1] & (bits << (64 - x));
+                    row[1] ^= bits << (64 - x);
+                }
+                return collision;
+            }
+            uint64_t collision = row[1] & (bits >> (x - 64));
+            row[1] ^= bits >> (x - 64);
+            return collision;
+        }
+
+        // as blit(), pixels past the right edge wrap around to the left one (XO-CHIP)
+        uint64_t blit_wrap(int plane, int y, int x, uint64_t bits) {
+            uint64_t *row = rows[plane][y];
+            uint64_t left;
+            uint64_t right;
+            if (width <= 64) {
+                left = (bits >> x) | (x ? bits << (64 - x) : 0);
+                right = 0;
+            } else if (x < 64) {
+                left = bits >> x;
+                right = x ? bits << (64 - x) : 0;
+            } else {
+                left = x > 64 ? bits << (128 - x) : 0;
+                right = bits >> (x - 64);
+            }
+            uint64_t collision = (row[0] & left) | (row[1] & right);
+            row[0] ^= left;
+            row[1] ^= right;
+            return collision;
+        }
 
-        std::vector<Pixel> pixels{};
+        uint64_t rows[PLANES][MAX_HEIGHT][ROW_WORDS]{};
+        // planes affected by clear(), scrolling and XO-CHIP sprites (FN01)
+        uint8_t selected{1};
         Screen screen;
         int width {0};
         int height {0};
+        bool headless {false};
+        // bit y set - row y changed, set by the core and cleared by present()
+        uint64_t dirty {ALL_ROWS};
+#ifdef CHIP8_PROFILE
+        profiler::Timing draw_time;
+#endif
     };
 
 }
@@ -0,0 +1,74 @@
+#ifndef CHIP8_EMULATOR_INPUT_H
+#define CHIP8_EMULATOR_INPUT_H
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace input {
+    // keypad state from 'frame' on, until the next event
+    struct KeyEvent {
+        uint64_t frame;
+        uint16_t keys;
+    };
+
+    /*
+     * Everything needed to replay a session: the keypad state of every frame
+     * (stored as changes only), the PRNG seed and the instructions per frame.
+     *
+     * File format, little endian: "C8IN", uint32_t version, uint32_t seed,
+     * uint32_t instructions per frame, uint64_t frames, uint32_t event count,
+     * then per event the frame delta to the previous event as LEB128 and the
+     * uint16_t keys.
+     */
+    struct Log {
+        static constexpr uint32_t VERSION = 1;
+
+        // records the keys of the next frame, frames must be recorded in order
+        void record(uint16_t keys);
+        bool save(const std::string &path) const;
+        bool load(const std::string &path);
+
+        uint32_t seed{DEFAULT_SEED};
+        int instructions_per_frame{INSTRUCTIONS_PER_FRAME};
+        // length of the session
+        uint64_t frames{0};
+        // sorted by frame
+        std::vector<KeyEvent> events{};
+    };
+
+    /*
+     * Keypad state from the SDL event queue, pumped once per frame by the
+     * thread owning the window. A key pressed and released between two
+     * pumps is still down for one frame, EX9E and FX0A see every tap.
+     */
+    struct Keypad {
+        // drains the event queue, false once the window was closed
+        bool pump();
+        uint16_t keys() const { return _down | _tapped; }
+
+    private:
+        uint16_t _down{0};
+        // pressed during the last pump
+        uint16_t _tapped{0};
+    };
+
+    // plays back key events frame by frame
+    struct Player {
+        explicit Player(const std::vector<KeyEvent> &events) : _events(events) {}
+
+        // keypad state of 'frame', frames must be played in order
+        uint16_t keys(uint64_t frame);
+        // no events after the last frame played, the keys stay as they are
+        bool finished() const { return _next == _events.size(); }
+
+    private:
+        const std::vector<KeyEvent> &_events;
+        size_t _next{0};
+        uint16_t _keys{0};
+    };
+}
+
+#endif//CHIP8_EMULATOR_INPUT_H
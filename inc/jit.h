@@ -0,0 +1,53 @@
+#ifndef CHIP8_EMULATOR_JIT_H
+#define CHIP8_EMULATOR_JIT_H
+
+#include "chip8.h"
+
+#include <cstdint>
+
+namespace jit {
+    /*
+     * x86-64 dynamic recompiler for CHIP8 basic blocks.
+     *
+     * A block is a straight-line run of instructions ending at a jump, call,
+     * return, skip or memory write. ALU instructions are translated to native
+     * code working on V[], I and PC of the owning Chip8, everything else calls
+     * the interpreter handler. Blocks with a static successor are chained by
+     * patching their exit jump. A write into compiled code (FX33/FX55 or
+     * load_program) flushes the whole code cache.
+     */
+    struct Jit {
+        explicit Jit(Chip8 &chip);
+        ~Jit();
+
+        // false if the host is not x86-64 or code memory could not be mapped
+        bool available() const { return _buffer != nullptr; }
+        // executes up to 'cycles' instructions, returns how many were executed
+        uint64_t run(uint64_t cycles);
+        void invalidate(uint16_t address, uint16_t length);
+
+    private:
+        using Enter = uint8_t *(*)(Chip8 *chip, uint8_t *code, int64_t *budget);
+
+        uint8_t *compile(uint16_t address);
+        void flush();
+        static void execute(Chip8 *chip, const DecodedOp *op);
+
+        Chip8 &_chip;
+        uint8_t *_buffer{nullptr};
+        uint8_t *_start{nullptr};
+        uint8_t *_free{nullptr};
+        uint8_t *_exit{nullptr};
+        Enter _enter{nullptr};
+        bool _flush{false};
+
+        /* indexed by (even) address / 2 */
+        uint8_t *_blocks[4096 / 2]{nullptr};
+        uint8_t _lengths[4096 / 2]{0};
+        DecodedOp _ops[4096 / 2];
+        /* addresses translated into some block */
+        bool _covered[4096]{false};
+    };
+}
+
+#endif//CHIP8_EMULATOR_JIT_H
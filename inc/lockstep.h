@@ -0,0 +1,88 @@
+#ifndef CHIP8_EMULATOR_LOCKSTEP_H
+#define CHIP8_EMULATOR_LOCKSTEP_H
+
+#include "chip8.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace lockstep {
+    // lanes are processed in blocks of one AVX2 register of 8 bit values
+    constexpr int LANE_BLOCK = 32;
+    // instructions per lane scheduled at once, bounded by the 16 bit counters
+    constexpr int MAX_CHUNK = 0x4000;
+
+    /*
+     * Runs many instances (lanes) of one ROM in lockstep, e.g. with different
+     * input sequences. Registers are kept in struct-of-arrays form: all lanes
+     * sharing a PC execute the instruction together, ALU instructions and
+     * skips with AVX2 (when the host supports it) on a lane mask. Diverged
+     * lanes are regrouped every instruction, the lane that is furthest behind
+     * in the frame goes first.
+     *
+     * Implements the same instruction set as Chip8 (TimerMode::Frame) with
+     * the Profile::Modern quirks, every lane owns its memory, stack and
+     * framebuffer.
+     */
+    struct Engine {
+        explicit Engine(int lanes);
+
+        // loads the same ROM into all lanes and resets them
+        bool load_program(const std::string &path);
+        bool load_program(const uint8_t *program, size_t size);
+        // executes instructions_per_frame instructions on every running lane, then ticks the timers
+        void run_frame(int instructions_per_frame = INSTRUCTIONS_PER_FRAME);
+        // copies the state of a lane into a scalar Chip8
+        void extract(int lane, Chip8 &chip) const;
+        // false - scalar kernels even on an AVX2 host, to check one against the other
+        void use_avx2(bool enable);
+        bool avx2() const { return _avx2; }
+
+        uint8_t *v(int r) { return &V[r * stride]; }
+        uint8_t *mem(int lane) { return &memory[lane * 4096]; }
+
+        int lanes;
+        // lanes rounded up to LANE_BLOCK, padding lanes never run
+        int stride;
+
+        /* V[r * stride + lane] */
+        std::vector<uint8_t> V;
+        std::vector<uint16_t> I;
+        std::vector<uint16_t> PC;
+        /* stack[lane * 16 + i] */
+        std::vector<uint16_t> stack;
+        std::vector<uint8_t> sp;
+        std::vector<uint8_t> delay_timer;
+        std::vector<uint8_t> sound_timer;
+        // keypad state per lane, set by the caller before run_frame()
+        std::vector<uint16_t> keys;
+        // set when PC ran past the end of memory (Chip8::shutdown)
+        std::vector<uint8_t> halted;
+        // lanes suspended by FX0A (Chip8::key_wait)
+        std::vector<KeyWait> key_wait;
+        /* memory[lane * 4096 + address] */
+        std::vector<uint8_t> memory;
+        /* rows[lane * 32 + y] */
+        std::vector<uint64_t> rows;
+        // CXNN xorshift32 state, lane + 1 after load_program()
+        std::vector<uint32_t> rng;
+
+    private:
+        void run(int instructions);
+        void execute(uint16_t opcode);
+        // PC += 2 on the masked lanes where _cond is set
+        void skip();
+
+        bool _avx2{false};
+        std::vector<int16_t> _remaining;
+        // lanes executing the current instruction, 0xFF or 0 (0xFFFF or 0)
+        std::vector<uint8_t> _mask;
+        std::vector<uint16_t> _mask16;
+        std::vector<uint8_t> _cond;
+        // addresses written by any lane, code there may differ between lanes
+        bool _modified[4096]{false};
+    };
+}
+
+#endif//CHIP8_EMULATOR_LOCKSTEP_H
@@ -0,0 +1,29 @@
+#ifndef CHIP8_EMULATOR_PACER_H
+#define CHIP8_EMULATOR_PACER_H
+
+#include <chrono>
+#include <cstdint>
+
+/*
+ * Paces a loop to a fixed rate. Deadlines are absolute, so oversleeping in one
+ * frame is taken out of the next one instead of accumulating as drift.
+ */
+struct FramePacer {
+    using clock = std::chrono::steady_clock;
+
+    explicit FramePacer(double hz = 60.0);
+
+    // sleeps until the deadline of the next frame
+    void wait();
+    // frames per second measured since construction
+    double rate() const;
+
+    clock::duration period;
+    uint64_t frames{0};
+
+private:
+    clock::time_point _start;
+    clock::time_point _next;
+};
+
+#endif//CHIP8_EMULATOR_PACER_H
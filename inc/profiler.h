@@ -0,0 +1,92 @@
+#ifndef CHIP8_EMULATOR_PROFILER_H
+#define CHIP8_EMULATOR_PROFILER_H
+
+/*
+ * Optional execution profiler, enabled with the CHIP8_PROFILE build option.
+ * Without it the CHIP8_PROFILE_* macros expand to nothing.
+ */
+#ifdef CHIP8_PROFILE
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace profiler {
+    struct Timing {
+        uint64_t calls{0};
+        uint64_t ns{0};
+    };
+
+    // adds the lifetime of the scope to a Timing
+    struct Scope {
+        explicit Scope(Timing &timing) : _timing(timing), _start(std::chrono::steady_clock::now()) {}
+        ~Scope() {
+            ++_timing.calls;
+            _timing.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+        }
+
+    private:
+        Timing &_timing;
+        std::chrono::steady_clock::time_point _start;
+    };
+
+    /*
+     * Counts executed instructions per opcode and per address, and per call
+     * stack. Call stacks are followed through 2NNN and 00EE.
+     */
+    struct Profiler {
+        Profiler();
+
+        // called before the instruction at 'pc' executes
+        void instruction(uint16_t pc, uint16_t opcode) {
+            ++_opcodes[opcode];
+            ++_addresses[pc & 0xFFF];
+            ++_nodes[_node].count;
+            if ((opcode >> 12) == 0x2) {
+                call(opcode & 0xFFF);
+            } else if (opcode == 0x00EE && _node) {
+                _node = _nodes[_node].parent;
+            }
+        }
+
+        // hot spot report sorted by instruction count, 'draw' is the time in Display::draw
+        void report(FILE *out, const Timing &draw) const;
+        // one line per call stack: "main;sub_2A4;sub_300 <instructions>"
+        bool write_folded(const std::string &path) const;
+
+        Timing dxyn;
+
+    private:
+        struct Node {
+            uint32_t parent;
+            uint16_t address;
+            uint16_t depth;
+            uint64_t count;
+        };
+
+        void call(uint16_t address);
+
+        std::vector<uint64_t> _opcodes;
+        std::vector<uint64_t> _addresses;
+        // call tree, node 0 is the top level
+        std::vector<Node> _nodes;
+        // (parent << 16 | address) -> node
+        std::unordered_map<uint64_t, uint32_t> _children;
+        uint32_t _node{0};
+    };
+}
+
+#define CHIP8_PROFILE_INSTRUCTION(profiler, pc, opcode) (profiler).instruction(pc, opcode)
+#define CHIP8_PROFILE_SCOPE(timing) profiler::Scope profile_scope_(timing)
+
+#else
+
+#define CHIP8_PROFILE_INSTRUCTION(profiler, pc, opcode)
+#define CHIP8_PROFILE_SCOPE(timing)
+
+#endif
+
+#endif//CHIP8_EMULATOR_PROFILER_H
@@ -0,0 +1,63 @@
+#ifndef CHIP8_EMULATOR_REWIND_H
+#define CHIP8_EMULATOR_REWIND_H
+
+#include "chip8.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/*
+ * History of per-frame snapshots for stepping backwards. A snapshot is a
+ * State followed by the XO-CHIP HighMemory, zero for the other profiles.
+ * Only the newest one is kept whole, every older frame is a record holding
+ * the XOR of it and its successor, run-length encoded (most frames change
+ * a few bytes).
+ * Records live in a fixed-size ring buffer, the oldest ones are dropped
+ * when it is full.
+ *
+ * Record layout: uint32_t length, length bytes of segments, uint32_t length.
+ * Segment: uint16_t unchanged bytes, uint16_t changed bytes n, n XOR bytes.
+ * Longer runs are split over several segments.
+ */
+struct RewindBuffer {
+    // 'bytes' of history, at most 'max_frames' steps back
+    RewindBuffer(size_t bytes, size_t max_frames);
+
+    // appends the snapshot of the next frame, 'high_memory' is read if state.high_memory
+    void push(const State &state, const HighMemory *high_memory = nullptr);
+    // steps one frame back, false if there is no older frame. 'high_memory' is written if state.high_memory
+    bool pop(State &state, HighMemory *high_memory = nullptr);
+    void clear();
+
+    // frames pop() can go back
+    size_t frames() const { return _count; }
+    // bytes used by the records
+    size_t size() const { return _used; }
+
+private:
+    // XOR of the first 'size' bytes of _current and _next into _scratch
+    size_t encode(size_t size);
+    void decode(size_t length);
+    void write(const void *data, size_t length);
+    void read(size_t position, void *data, size_t length) const;
+    void drop_oldest();
+
+    std::vector<uint8_t> _buffer;
+    size_t _max_frames;
+    // write position and position of the oldest record
+    size_t _head{0};
+    size_t _tail{0};
+    size_t _used{0};
+    size_t _count{0};
+    bool _valid{false};
+    // the newest snapshot and the one being pushed
+    std::vector<uint8_t> _current;
+    std::vector<uint8_t> _next;
+    // _current holds XO-CHIP memory
+    bool _high{false};
+    // encoded record, worst case every changed byte costs a segment header
+    std::vector<uint8_t> _scratch;
+};
+
+#endif//CHIP8_EMULATOR_REWIND_H
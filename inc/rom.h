@@ -0,0 +1,48 @@
+#ifndef CHIP8_EMULATOR_ROM_H
+#define CHIP8_EMULATOR_ROM_H
+
+#include "chip8.h"
+
+#include <bitset>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace rom {
+    // content hash of a program image
+    uint64_t hash(const uint8_t *program, size_t size);
+
+    struct Analysis {
+        uint64_t hash{0};
+        std::vector<uint8_t> program{};
+        // guessed from the instructions used, Profile::Modern unless SUPER-CHIP or XO-CHIP ones show up
+        Profile profile{Profile::Modern};
+        // bytes reached by following the control flow from PROGRAM_START, the rest is data
+        std::bitset<4096> code{};
+        // instructions at the even code addresses decoded for 'profile', by (address - PROGRAM_START) / 2
+        std::vector<DecodedOp> decoded{};
+    };
+
+    // static analysis of a program, everything but 'decoded'
+    Analysis analyze(const uint8_t *program, size_t size);
+
+    /*
+     * Analyses of loaded programs keyed by their content hash, shared by any
+     * number of Chip8 instances (see Chip8::load_program()). Thread safe.
+     */
+    struct Cache {
+        // nullptr if the program was not analyzed yet
+        std::shared_ptr<const Analysis> find(const uint8_t *program, size_t size) const;
+        // returns the entry of the same program if another thread was faster
+        std::shared_ptr<const Analysis> insert(std::shared_ptr<const Analysis> analysis);
+        size_t size() const;
+
+    private:
+        mutable std::mutex _mutex;
+        std::unordered_multimap<uint64_t, std::shared_ptr<const Analysis>> _entries;
+    };
+}
+
+#endif//CHIP8_EMULATOR_ROM_H
@@ -0,0 +1,83 @@
+#include "audio.h"
+
+#include <cstring>
+
+// square wave / pattern amplitude, well below full scale
+constexpr int16_t VOLUME = 4000;
+
+audio::Beeper::~Beeper() {
+    if (_device) {
+        SDL_CloseAudioDevice(_device);
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    }
+}
+
+bool audio::Beeper::init() {
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
+        return false;
+    }
+
+    SDL_AudioSpec want{};
+    want.freq = SAMPLE_RATE;
+    want.format = AUDIO_S16SYS;
+    want.channels = 1;
+    want.samples = BUFFER_SAMPLES;
+    want.callback = callback;
+    want.userdata = this;
+    // NOTE: no allowed changes, fill() relies on the format and rate
+    _device = SDL_OpenAudioDevice(nullptr, 0, &want, nullptr, 0);
+    if (!_device) {
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        return false;
+    }
+    SDL_PauseAudioDevice(_device, 0);
+    return true;
+}
+
+void audio::Beeper::tone(uint8_t ticks) {
+    Event event;
+    event.kind = Event::Kind::Tone;
+    event.ticks = ticks;
+    _events.push(event);
+}
+
+void audio::Beeper::pattern(const uint8_t *pattern) {
+    Event event;
+    event.kind = Event::Kind::Pattern;
+    std::memcpy(event.pattern, pattern, sizeof(event.pattern));
+    _events.push(event);
+}
+
+void audio::Beeper::callback(void *userdata, Uint8 *stream, int len) {
+    static_cast<Beeper *>(userdata)->fill(reinterpret_cast<int16_t *>(stream), len / sizeof(int16_t));
+}
+
+void audio::Beeper::fill(int16_t *samples, int count) {
+    Event event;
+    while (_events.pop(event)) {
+        if (event.kind == Event::Kind::Tone) {
+            _remaining = event.ticks * SAMPLE_RATE / 60;
+        } else {
+            std::memcpy(_pattern, event.pattern, sizeof(_pattern));
+            _use_pattern = true;
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        if (!_remaining) {
+            samples[i] = 0;
+            continue;
+        }
+        --_remaining;
+        bool high;
+        if (_use_pattern) {
+            // 128 bits, most significant bit of the first byte first
+            uint32_t bit = (uint64_t) _phase * PATTERN_HZ / SAMPLE_RATE % 128;
+            high = (_pattern[bit >> 3] >> (7 - (bit & 7))) & 1;
+        } else {
+            high = (uint64_t) _phase * TONE_HZ * 2 / SAMPLE_RATE % 2 == 0;
+        }
+        samples[i] = high ? VOLUME : -VOLUME;
+        _phase = (_phase + 1) % (SAMPLE_RATE * 128);
+    }
+}
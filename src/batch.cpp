@@ -0,0 +1,105 @@
+#include "batch.h"
+#include "rom.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+
+namespace {
+    struct Fnv {
+        void add(const void *data, size_t size) {
+            auto bytes = (const uint8_t *) data;
+            for (size_t i = 0; i < size; ++i) {
+                hash ^= bytes[i];
+                hash *= 0x100000001B3ull;
+            }
+        }
+
+        uint64_t hash{0xCBF29CE484222325ull};
+    };
+}
+
+uint64_t batch::state_hash(const Chip8 &chip) {
+    Fnv fnv;
+    fnv.add(chip.memory, sizeof(chip.memory));
+    if (chip.high_memory()) {
+        fnv.add(chip.high_memory(), XO_MEMORY_SIZE - 4096);
+    }
+    fnv.add(chip.V, sizeof(chip.V));
+    fnv.add(&chip.I, sizeof(chip.I));
+    fnv.add(&chip.PC, sizeof(chip.PC));
+    fnv.add(chip.stack.stack, sizeof(chip.stack.stack));
+    fnv.add(&chip.stack.index, sizeof(chip.stack.index));
+    uint8_t timers[] = {chip.delay_timer.get(), chip.sound_timer.get()};
+    fnv.add(timers, sizeof(timers));
+    uint32_t rng = chip.rng();
+    fnv.add(&rng, sizeof(rng));
+    fnv.add(&chip.key_wait.x, sizeof(chip.key_wait.x));
+    fnv.add(&chip.key_wait.ignored, sizeof(chip.key_wait.ignored));
+    fnv.add(&chip.key_wait.pressed, sizeof(chip.key_wait.pressed));
+    fnv.add(chip.audio_pattern, sizeof(chip.audio_pattern));
+    int resolution[] = {chip.display.width, chip.display.height};
+    fnv.add(resolution, sizeof(resolution));
+    fnv.add(&chip.display.selected, sizeof(chip.display.selected));
+    fnv.add(chip.display.rows, sizeof(chip.display.rows));
+    return fnv.hash;
+}
+
+batch::Result batch::run(const Job &job, rom::Cache *cache) {
+    Result result;
+    // NOTE: ~70 KB, keep it off the worker stack
+    auto chip = std::make_unique<Chip8>(TimerMode::Frame);
+    bool loaded = job.program.empty() ? chip->load_program(job.rom, cache)
+                                      : chip->load_program(job.program.data(), job.program.size(), cache);
+    if (!loaded || !chip->init(true)) {
+        return result;
+    }
+
+    chip->seed(job.seed);
+
+    input::Player player(job.input);
+    for (uint64_t frame = 0; result.executed < job.cycles && !chip->shutdown; ++frame) {
+        chip->keys = player.keys(frame);
+        auto budget = std::min<uint64_t>(job.instructions_per_frame, job.cycles - result.executed);
+        result.executed += chip->run_frame(budget);
+        if ((chip->key_wait.waiting() && player.finished()) || chip->stuck()) {
+            // FX0A, but the keys never change again, or a self-jump with nothing left to count down
+            break;
+        }
+    }
+
+    result.ok = true;
+    result.state_hash = state_hash(*chip);
+    std::memcpy(result.rows, chip->display.rows, sizeof(result.rows));
+    return result;
+}
+
+std::vector<batch::Result> batch::run(const std::vector<Job> &jobs, unsigned workers) {
+    std::vector<Result> results(jobs.size());
+    if (!workers) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = std::min<size_t>(workers, jobs.size());
+
+    rom::Cache cache;
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < jobs.size(); i = next++) {
+            results[i] = run(jobs[i], &cache);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < workers; ++i) {
+        pool.emplace_back(worker);
+    }
+    // the calling thread is a worker as well
+    worker();
+    for (auto &thread : pool) {
+        thread.join();
+    }
+
+    return results;
+}
@@ -1,52 +1,332 @@
 #include "chip8.h"
+#include "audio.h"
 #include "font.h"
+#include "jit.h"
+#include "pacer.h"
+#include "rom.h"
+#include <algorithm>
+#include <array>
 #include <cstring>
-#include <chrono>
 #include <cstdlib>
 #include <fstream>
+#include <type_traits>
+#include <utility>
 
 // TODO: configurable display size
-Chip8::Chip8() : display(DISPLAY_WIDTH, DISPLAY_HEIGHT), _timer_thread(timer_fnc, this)  {
-
+Chip8::Chip8(TimerMode timer_mode) : display(DISPLAY_WIDTH, DISPLAY_HEIGHT), _timer_mode(timer_mode) {
+    select_profile<Profile::Modern>();
+    if (_timer_mode == TimerMode::Thread) {
+        _timer_thread = std::thread(timer_fnc, this);
+    }
 }
 
 Chip8::~Chip8() {
     shutdown = 1;
-    _timer_thread.join();
+    if (_timer_thread.joinable()) {
+        _timer_thread.join();
+    }
 }
 
 void Chip8::init_font() {
-    int index = 0x50;
-    std::memcpy(&memory[index], font, 5 * 16);
+    std::memcpy(&memory[FONT_START], font, sizeof(font));
+    std::memcpy(&memory[BIG_FONT_START], big_font, sizeof(big_font));
+    invalidate(FONT_START, BIG_FONT_START + sizeof(big_font) - FONT_START);
 }
 
-bool Chip8::load_program(const std::string &path) {
-    std::ifstream inputFile(path, std::ios_base::binary);
+bool Chip8::load_program(const std::string &path, rom::Cache *cache) {
+    std::ifstream inputFile(path, std::ios_base::binary | std::ios_base::ate);
     if (!inputFile.is_open()) {
         return false;
     }
 
-    int program_index = 0x200;
+    // one read straight into memory, after checking that it fits
+    auto size = (std::streamoff) inputFile.tellg();
+    if (size < 0 || size > MAX_XO_PROGRAM_SIZE) {
+        return false;
+    }
+    inputFile.seekg(0);
+    if (size > MAX_PROGRAM_SIZE) {
+        // XO-CHIP, continues past the first 4 KB
+        std::vector<uint8_t> program(size);
+        return inputFile.read((char *) program.data(), size) && load_program(program.data(), size, cache);
+    }
+    if (!inputFile.read((char *) &memory[PROGRAM_START], size)) {
+        return false;
+    }
+
+    program_loaded(&memory[PROGRAM_START], size, cache);
+    return true;
+}
+
+bool Chip8::load_program(const uint8_t *program, size_t size, rom::Cache *cache) {
+    if (size > MAX_XO_PROGRAM_SIZE) {
+        return false;
+    }
+    std::memcpy(&memory[PROGRAM_START], program, std::min<size_t>(size, MAX_PROGRAM_SIZE));
+    program_loaded(program, size, cache);
+    return true;
+}
+
+void Chip8::program_loaded(const uint8_t *program, size_t size, rom::Cache *cache) {
+    auto analysis = cache ? cache->find(program, size) : nullptr;
+    if (!analysis) {
+        auto fresh = std::make_shared<rom::Analysis>(rom::analyze(program, size));
+        set_profile(fresh->profile);
+        // only the first 4 KB can hold code
+        fresh->decoded.resize((std::min<size_t>(size, MAX_PROGRAM_SIZE) + 1) / 2);
+        for (size_t i = 0; i < fresh->decoded.size(); ++i) {
+            int address = PROGRAM_START + 2 * i;
+            if (fresh->code[address]) {
+                fresh->decoded[i] = predecode(address);
+            }
+        }
+        analysis = cache ? cache->insert(fresh) : fresh;
+    }
+
+    if (_profile != analysis->profile) {
+        set_profile(analysis->profile);
+    }
+    if (_high_memory) {
+        std::memset(_high_memory.get(), 0, XO_MEMORY_SIZE - 4096);
+        if (size > MAX_PROGRAM_SIZE) {
+            std::memcpy(_high_memory.get(), program + MAX_PROGRAM_SIZE, size - MAX_PROGRAM_SIZE);
+        }
+    }
+    invalidate(PROGRAM_START, std::min<size_t>(size, MAX_PROGRAM_SIZE));
+    std::copy(analysis->decoded.begin(), analysis->decoded.end(), &_decoded[PROGRAM_START >> 1]);
+}
+
+void Chip8::set_profile(Profile profile) {
+    _profile = profile;
+    switch (profile) {
+        case Profile::CosmacVip: select_profile<Profile::CosmacVip>(); break;
+        case Profile::Chip48: select_profile<Profile::Chip48>(); break;
+        case Profile::SuperChip: select_profile<Profile::SuperChip>(); break;
+        case Profile::Modern: select_profile<Profile::Modern>(); break;
+        case Profile::XoChip: select_profile<Profile::XoChip>(); break;
+    }
+    if (quirks_of(profile).xo && !_high_memory) {
+        _high_memory.reset(new uint8_t[XO_MEMORY_SIZE - 4096]());
+    }
+    // decoded handlers, threaded labels and JIT code belong to the previous profile
+    invalidate(0, 4096);
+}
+
+void Chip8::invalidate(uint16_t address, uint16_t length) {
+    // only even addresses are cached, byte at 'address' belongs to entry address / 2
+    int first = address >> 1;
+    int last = std::min((address + length - 1) >> 1, (int) (sizeof(_decoded) / sizeof(_decoded[0])) - 1);
+    for (int i = first; i <= last; ++i) {
+        _decoded[i] = DecodedOp();
+    }
+    if (_jit) {
+        _jit->invalidate(address, length);
+    }
+}
+
+template<Profile P>
+void Chip8::invalidate_ram(uint32_t address, uint32_t length) {
+    constexpr uint32_t size = quirks_of(P).xo ? XO_MEMORY_SIZE : 4096;
+    address &= size - 1;
+    uint32_t end = address + length;
+    // only the first 4 KB hold decoded code, a range past the end continues at 0
+    if (address < 4096) {
+        invalidate(address, std::min<uint32_t>(end, 4096) - address);
+    }
+    if (end > size) {
+        invalidate(0, end - size);
+    }
+}
+
+void Chip8::seed(uint32_t value) {
+    _rng = value ? value : DEFAULT_SEED;
+}
+
+static_assert(std::is_trivially_copyable<State>::value, "State is copied as raw bytes");
 
-    char c = inputFile.get();
-    while (inputFile.good()) {
-        memory[program_index++] = c;
-        c = inputFile.get();
+void Chip8::save_state(State &state, HighMemory *high_memory) const {
+    state.version = State::VERSION;
+    state.PC = PC;
+    state.I = I;
+    std::memcpy(state.V, V, sizeof(V));
+    std::memcpy(state.stack, stack.stack, sizeof(stack.stack));
+    state.stack_index = stack.index;
+    state.delay_timer = delay_timer.get();
+    state.sound_timer = sound_timer.get();
+    state.rng = _rng;
+    std::memcpy(state.memory, memory, sizeof(memory));
+    state.high_memory = quirks_of(_profile).xo && high_memory;
+    if (state.high_memory) {
+        std::memcpy(high_memory->bytes, _high_memory.get(), sizeof(high_memory->bytes));
     }
+    state.width = display.width;
+    state.height = display.height;
+    state.selected = display.selected;
+    std::memcpy(state.audio_pattern, audio_pattern, sizeof(audio_pattern));
+    state.key_wait = key_wait;
+    std::memcpy(state.rows, display.rows, sizeof(display.rows));
+}
 
-    inputFile.close();
+bool Chip8::load_state(const State &state, const HighMemory *high_memory) {
+    if (state.version != State::VERSION || (state.high_memory && !high_memory)) {
+        return false;
+    }
+    PC = state.PC;
+    I = state.I;
+    std::memcpy(V, state.V, sizeof(V));
+    std::memcpy(stack.stack, state.stack, sizeof(stack.stack));
+    stack.index = state.stack_index;
+    delay_timer.set(state.delay_timer);
+    sound_timer.set(state.sound_timer);
+    _rng = state.rng;
+    // usually only data changed, keep the decoded code of unchanged blocks
+    constexpr int BLOCK = 256;
+    for (int address = 0; address < 4096; address += BLOCK) {
+        if (std::memcmp(&memory[address], &state.memory[address], BLOCK)) {
+            std::memcpy(&memory[address], &state.memory[address], BLOCK);
+            invalidate(address, BLOCK);
+        }
+    }
+    // no code is decoded above 4 KB
+    if (state.high_memory && _high_memory) {
+        std::memcpy(_high_memory.get(), high_memory->bytes, sizeof(high_memory->bytes));
+    }
+    if (display.width != state.width || display.height != state.height) {
+        display.resize(state.width, state.height);
+    }
+    display.selected = state.selected;
+    std::memcpy(audio_pattern, state.audio_pattern, sizeof(audio_pattern));
+    key_wait = state.key_wait;
+    std::memcpy(display.rows, state.rows, sizeof(display.rows));
+    display.dirty = display::Display::ALL_ROWS;
+    return true;
+}
 
+bool Chip8::set_backend(Backend backend) {
+#ifdef CHIP8_PROFILE
+    // only the interpreter is instrumented
+    if (backend != Backend::Interpreter) {
+        return false;
+    }
+#endif
+#if !defined(__GNUC__)
+    if (backend == Backend::Threaded) {
+        return false;
+    }
+#endif
+    if (backend == Backend::Jit && !_jit) {
+        _jit.reset(new jit::Jit(*this));
+        if (!_jit->available()) {
+            _jit.reset();
+            return false;
+        }
+    }
+    _backend = backend;
     return true;
 }
 
+uint64_t Chip8::run(uint64_t cycles) {
+    if (key_wait.waiting()) {
+        int key = key_wait.released(keys.load(std::memory_order_relaxed));
+        if (key < 0) {
+            return 0;
+        }
+        V[key_wait.x] = key;
+        key_wait.x = -1;
+    }
+    if (skip_idle && !shutdown && skip_idle_loop(cycles)) {
+        return cycles;
+    }
+    if (_backend == Backend::Jit) {
+        return _jit->run(cycles);
+    }
+    if (_backend == Backend::Threaded) {
+        return (this->*_run_threaded)(cycles);
+    }
+    uint64_t executed = 0;
+    while (executed < cycles && !shutdown && !key_wait.waiting()) {
+        fetch_decode_execute();
+        ++executed;
+    }
+    return executed;
+}
+
+uint64_t Chip8::run_frame(int instructions_per_frame) {
+    auto executed = run(instructions_per_frame);
+    if (_timer_mode == TimerMode::Frame) {
+        tick_timers();
+    }
+    return executed;
+}
+
+bool Chip8::skip_idle_loop(uint64_t cycles) {
+    if (PC >= 4095) {
+        return false;
+    }
+    Instruction at(memory[PC], memory[PC + 1]);
+    if (at.FN() == 0x1 && at.nnn == PC) {
+        return true;
+    }
+
+    // a timer thread may change the delay timer within the frame, polling it must run
+    if (_timer_mode != TimerMode::Frame) {
+        return false;
+    }
+    // FX07, 3XNN, 1NNN back to the FX07, PC may be on any of them
+    for (int phase = 0; phase < 3; ++phase) {
+        int start = PC - 2 * phase;
+        if (start < 0 || start > 4096 - 6) {
+            continue;
+        }
+        Instruction get(memory[start], memory[start + 1]);
+        Instruction skip(memory[start + 2], memory[start + 3]);
+        Instruction jump(memory[start + 4], memory[start + 5]);
+        if ((get.value & 0xF0FF) != 0xF007 || skip.FN() != 0x3 || skip.x != get.x || jump.value != (0x1000 | start)) {
+            continue;
+        }
+        // 3XNN leaves the loop when it sees NN, in VX from the last FX07 or in the timer
+        uint8_t timer = delay_timer.get();
+        if (timer == skip.nn || (phase == 1 && V[get.x] == skip.nn)) {
+            return false;
+        }
+        if (cycles > uint64_t((3 - phase) % 3)) {
+            V[get.x] = timer;
+        }
+        PC = start + 2 * ((phase + cycles) % 3);
+        return true;
+    }
+    return false;
+}
+
+bool Chip8::stuck() const {
+    return PC < 4095 && memory[PC] == (0x10 | PC >> 8) && memory[PC + 1] == (PC & 0xFF) &&
+           !delay_timer.get() && !sound_timer.get();
+}
+
+void Chip8::tick_timers() {
+    delay_timer.decr();
+    sound_timer.decr();
+}
+
 void Chip8::fetch_decode_execute() {
     if (PC >= 4096) {
         shutdown = 1;
         return;
     }
-    // fetch() increments PC by 2
-    auto instruction = fetch();
-    decode_execute(instruction);
+    if (PC & 1) {
+        // odd addresses are rare, not worth caching
+        auto instruction = fetch();
+        CHIP8_PROFILE_INSTRUCTION(profiling, PC - 2, instruction.value);
+        decode_execute(instruction);
+        return;
+    }
+    auto &op = _decoded[PC >> 1];
+    if (!op.handler) {
+        op = predecode(PC);
+    }
+    CHIP8_PROFILE_INSTRUCTION(profiling, PC, op.instruction.value);
+    PC += 2;
+    (this->*op.handler)(op.instruction);
 }
 
 Instruction Chip8::fetch() {
@@ -55,49 +335,479 @@ Instruction Chip8::fetch() {
     return instruction;
 }
 
+DecodedOp Chip8::predecode(uint16_t address) {
+    DecodedOp op;
+    op.instruction = Instruction(memory[address], memory[address + 1]);
+    op.handler = decode(op.instruction);
+    return op;
+}
+
+namespace {
+    /* register operands of a handler */
+    template<int X, int Y>
+    struct StaticRegs {
+        static constexpr int x(Instruction) { return X; }
+        static constexpr int y(Instruction) { return Y; }
+    };
+
+    struct DynamicRegs {
+        static int x(Instruction instruction) { return instruction.X(); }
+        static int y(Instruction instruction) { return instruction.Y(); }
+    };
+
+    enum class RegisterOp {
+        op3XNN, op4XNN, op5XY0, op5XY2, op5XY3, op6XNN, op7XNN,
+        op8XY0, op8XY1, op8XY2, op8XY3, op8XY4, op8XY5, op8XY6, op8XY7, op8XYE,
+        op9XY0, opCXNN, opDXYN, opDXY0, opEX9E, opEXA1,
+        opFX07, opFX15, opFX18, opFX1E, opFX29, opFX30, opFX33, opFX55, opFX65
+    };
+
+    // handlers that only differ in the XO-CHIP address space are shared by the other profiles
+    constexpr Profile address_space(Profile profile) {
+        return quirks_of(profile).xo ? Profile::XoChip : Profile::Modern;
+    }
+}
+
+/*
+ * Compile time generated dispatch table: every 16 bit opcode maps straight to
+ * its handler, with X and Y baked in as template arguments where used. There
+ * is one table, built for the modern profile, the other profiles decode just
+ * the opcodes their quirks change with select().
+ */
+template<Profile P>
+struct Dispatch {
+    template<RegisterOp op, int X, int Y>
+    static constexpr OpHandler handler() {
+        using R = StaticRegs<X, Y>;
+        constexpr Profile A = address_space(P);
+        if constexpr (op == RegisterOp::op3XNN) return &Chip8::op_3XNN<A, R>;
+        else if constexpr (op == RegisterOp::op4XNN) return &Chip8::op_4XNN<A, R>;
+        else if constexpr (op == RegisterOp::op5XY0) return &Chip8::op_5XY0<A, R>;
+        else if constexpr (op == RegisterOp::op5XY2) return &Chip8::op_5XY2<R>;
+        else if constexpr (op == RegisterOp::op5XY3) return &Chip8::op_5XY3<R>;
+        else if constexpr (op == RegisterOp::op6XNN) return &Chip8::op_6XNN<R>;
+        else if constexpr (op == RegisterOp::op7XNN) return &Chip8::op_7XNN<R>;
+        else if constexpr (op == RegisterOp::op8XY0) return &Chip8::op_8XY0<R>;
+        else if constexpr (op == RegisterOp::op8XY1) return &Chip8::op_8XY1<R>;
+        else if constexpr (op == RegisterOp::op8XY2) return &Chip8::op_8XY2<R>;
+        else if constexpr (op == RegisterOp::op8XY3) return &Chip8::op_8XY3<R>;
+        else if constexpr (op == RegisterOp::op8XY4) return &Chip8::op_8XY4<R>;
+        else if constexpr (op == RegisterOp::op8XY5) return &Chip8::op_8XY5<R>;
+        else if constexpr (op == RegisterOp::op8XY6) return &Chip8::op_8XY6<P, R>;
+        else if constexpr (op == RegisterOp::op8XY7) return &Chip8::op_8XY7<R>;
+        else if constexpr (op == RegisterOp::op8XYE) return &Chip8::op_8XYE<P, R>;
+        else if constexpr (op == RegisterOp::op9XY0) return &Chip8::op_9XY0<A, R>;
+        else if constexpr (op == RegisterOp::opCXNN) return &Chip8::op_CXNN<R>;
+        else if constexpr (op == RegisterOp::opDXYN) return &Chip8::op_DXYN<A, R>;
+        else if constexpr (op == RegisterOp::opDXY0) return &Chip8::op_DXY0<A, R>;
+        else if constexpr (op == RegisterOp::opEX9E) return &Chip8::op_EX9E<A, R>;
+        else if constexpr (op == RegisterOp::opEXA1) return &Chip8::op_EXA1<A, R>;
+        else if constexpr (op == RegisterOp::opFX07) return &Chip8::op_FX07<R>;
+        else if constexpr (op == RegisterOp::opFX15) return &Chip8::op_FX15<R>;
+        else if constexpr (op == RegisterOp::opFX18) return &Chip8::op_FX18<R>;
+        else if constexpr (op == RegisterOp::opFX1E) return &Chip8::op_FX1E<A, R>;
+        else if constexpr (op == RegisterOp::opFX29) return &Chip8::op_FX29<R>;
+        else if constexpr (op == RegisterOp::opFX30) return &Chip8::op_FX30<R>;
+        else if constexpr (op == RegisterOp::opFX33) return &Chip8::op_FX33<A, R>;
+        else if constexpr (op == RegisterOp::opFX55) return &Chip8::op_FX55<P, R>;
+        else return &Chip8::op_FX65<P, R>;
+    }
+
+    /* handlers indexed by X (16 entries) or by XY (256 entries) */
+    template<RegisterOp op, size_t... X>
+    static constexpr std::array<OpHandler, sizeof...(X)> by_x(std::index_sequence<X...>) {
+        return {{handler<op, X, 0>()...}};
+    }
+    template<RegisterOp op, size_t... XY>
+    static constexpr std::array<OpHandler, sizeof...(XY)> by_xy(std::index_sequence<XY...>) {
+        return {{handler<op, (XY >> 4), (XY & 0xF)>()...}};
+    }
+    template<RegisterOp op>
+    static constexpr std::array<OpHandler, 16> x = by_x<op>(std::make_index_sequence<16>{});
+    template<RegisterOp op>
+    static constexpr std::array<OpHandler, 256> xy = by_xy<op>(std::make_index_sequence<256>{});
+
+    static constexpr OpHandler select(uint16_t value) {
+        const Instruction instruction((value >> 8) & 0xFF, value & 0xFF);
+        const int x = instruction.x;
+        const int xy = (instruction.x << 4) | instruction.y;
+        switch (instruction.FN()) {
+            case 0:
+                // NOTE: 0NNN is not supported
+                if (value == 0x00E0) return &Chip8::op_00E0;
+                if (value == 0x00EE) return &Chip8::op_00EE;
+                if constexpr (quirks_of(P).hires) {
+                    if ((value & 0xFFF0) == 0x00C0) return &Chip8::op_00CN;
+                    switch (value) {
+                        case 0x00FB: return &Chip8::op_00FB;
+                        case 0x00FC: return &Chip8::op_00FC;
+                        case 0x00FD: return &Chip8::op_00FD;
+                        case 0x00FE: return &Chip8::op_00FE;
+                        case 0x00FF: return &Chip8::op_00FF;
+                        default: break;
+                    }
+                }
+                if constexpr (quirks_of(P).xo) {
+                    if ((value & 0xFFF0) == 0x00D0) return &Chip8::op_00DN;
+                }
+                return &Chip8::op_0NNN;
+            case 1: return &Chip8::op_1NNN;
+            case 2: return &Chip8::op_2NNN;
+            case 3: return Dispatch::x<RegisterOp::op3XNN>[x];
+            case 4: return Dispatch::x<RegisterOp::op4XNN>[x];
+            case 5:
+                if (quirks_of(P).xo && instruction.N() == 2) return Dispatch::xy<RegisterOp::op5XY2>[xy];
+                if (quirks_of(P).xo && instruction.N() == 3) return Dispatch::xy<RegisterOp::op5XY3>[xy];
+                return Dispatch::xy<RegisterOp::op5XY0>[xy];
+            case 6: return Dispatch::x<RegisterOp::op6XNN>[x];
+            case 7: return Dispatch::x<RegisterOp::op7XNN>[x];
+            case 8:
+                switch (instruction.N()) {
+                    case 0: return Dispatch::xy<RegisterOp::op8XY0>[xy];
+                    case 1: return Dispatch::xy<RegisterOp::op8XY1>[xy];
+                    case 2: return Dispatch::xy<RegisterOp::op8XY2>[xy];
+                    case 3: return Dispatch::xy<RegisterOp::op8XY3>[xy];
+                    case 4: return Dispatch::xy<RegisterOp::op8XY4>[xy];
+                    case 5: return Dispatch::xy<RegisterOp::op8XY5>[xy];
+                    case 6: return Dispatch::xy<RegisterOp::op8XY6>[xy];
+                    case 7: return Dispatch::xy<RegisterOp::op8XY7>[xy];
+                    case 0xE: return Dispatch::xy<RegisterOp::op8XYE>[xy];
+                    default: return &Chip8::op_unknown;
+                }
+            case 9: return Dispatch::xy<RegisterOp::op9XY0>[xy];
+            case 0xA: return &Chip8::op_ANNN;
+            case 0xB: return &Chip8::op_BNNN<P>;
+            case 0xC: return Dispatch::x<RegisterOp::opCXNN>[x];
+            case 0xD:
+                if (quirks_of(P).hires && !instruction.N()) return Dispatch::xy<RegisterOp::opDXY0>[xy];
+                return Dispatch::xy<RegisterOp::opDXYN>[xy];
+            case 0xE:
+                switch (instruction.NN()) {
+                    case 0x9E: return Dispatch::x<RegisterOp::opEX9E>[x];
+                    case 0xA1: return Dispatch::x<RegisterOp::opEXA1>[x];
+                    default: return &Chip8::op_unknown;
+                }
+            case 0xF:
+                switch (instruction.NN()) {
+                    case 0x00:
+                        if (quirks_of(P).xo && value == 0xF000) return &Chip8::op_F000;
+                        return &Chip8::op_unknown;
+                    case 0x01:
+                        if (quirks_of(P).xo) return &Chip8::op_FN01;
+                        return &Chip8::op_unknown;
+                    case 0x02:
+                        if (quirks_of(P).xo && value == 0xF002) return &Chip8::op_F002;
+                        return &Chip8::op_unknown;
+                    case 0x07: return Dispatch::x<RegisterOp::opFX07>[x];
+                    case 0x0A: return &Chip8::op_FX0A;
+                    case 0x15: return Dispatch::x<RegisterOp::opFX15>[x];
+                    case 0x18: return Dispatch::x<RegisterOp::opFX18>[x];
+                    case 0x1E: return Dispatch::x<RegisterOp::opFX1E>[x];
+                    case 0x29: return Dispatch::x<RegisterOp::opFX29>[x];
+                    case 0x30:
+                        if (quirks_of(P).hires) return Dispatch::x<RegisterOp::opFX30>[x];
+                        return &Chip8::op_unknown;
+                    case 0x33: return Dispatch::x<RegisterOp::opFX33>[x];
+                    case 0x55: return Dispatch::x<RegisterOp::opFX55>[x];
+                    case 0x65: return Dispatch::x<RegisterOp::opFX65>[x];
+                    default: return &Chip8::op_unknown;
+                }
+            default: return &Chip8::op_unknown;
+        }
+    }
+
+    // true if P decodes 'value' to another handler than the modern profile
+    static constexpr bool differs(uint16_t value) {
+        constexpr Quirks q = quirks_of(P);
+        constexpr Quirks base = quirks_of(Profile::Modern);
+        // XO-CHIP handlers use the 16 bit address space
+        constexpr bool xo = q.xo != base.xo;
+        constexpr bool hires = q.hires != base.hires;
+        switch (value >> 12) {
+            case 0: return hires || xo;
+            case 3: case 4: case 5: case 9: case 0xE: return xo;
+            case 8: return ((value & 0xF) == 0x6 || (value & 0xF) == 0xE) && q.shift_vy != base.shift_vy;
+            case 0xB: return q.jump_vx != base.jump_vx;
+            case 0xD: return xo || (hires && !(value & 0xF));
+            case 0xF:
+                switch (value & 0xFF) {
+                    case 0x00: case 0x01: case 0x02: case 0x1E: case 0x33: return xo;
+                    case 0x30: return hires;
+                    case 0x55: case 0x65: return xo || q.load_store != base.load_store;
+                    default: return false;
+                }
+            default: return false;
+        }
+    }
+
+    // nullptr - the shared table holds the handler
+    static OpHandler quirk_handler(uint16_t value) {
+        return differs(value) ? select(value) : nullptr;
+    }
+
+    struct Table {
+        constexpr Table() {
+            for (uint32_t value = 0; value < 0x10000; ++value) {
+                handlers[value] = select(value);
+            }
+        }
+
+        OpHandler handlers[0x10000]{};
+    };
+};
+
+namespace {
+    constexpr Dispatch<Profile::Modern>::Table dispatch_table;
+}
+
+template<Profile P>
+void Chip8::select_profile() {
+    _quirk_handler = &Dispatch<P>::quirk_handler;
+    _run_threaded = &Chip8::run_threaded<P>;
+}
+
+OpHandler Chip8::decode(Instruction instruction) {
+    const OpHandler handler = _quirk_handler(instruction.value);
+    return handler ? handler : dispatch_table.handlers[instruction.value];
+}
+
 void Chip8::decode_execute(Instruction instruction) {
+    (this->*decode(instruction))(instruction);
+}
+
+#if defined(__GNUC__)
+/*
+ * Threaded code interpreter: every handler jumps straight to the handler of
+ * the next instruction (labels as values), so there is no call/return per
+ * instruction and no single shared indirect branch for the predictor.
+ * Label addresses are cached next to the pre-decoded instructions, the
+ * handlers are the same member functions as in decode(), inlined here.
+ */
+template<Profile P>
+uint64_t Chip8::run_threaded(uint64_t cycles) {
+    constexpr Profile A = address_space(P);
+    // 0, 5, 8, D, E and F families are resolved to their leaf handlers in do_decode
+    static void *const families[16] = {
+            nullptr, &&do_1NNN, &&do_2NNN, &&do_3XNN, &&do_4XNN, nullptr, &&do_6XNN, &&do_7XNN,
+            nullptr, &&do_9XY0, &&do_ANNN, &&do_BNNN, &&do_CXNN, nullptr, nullptr, nullptr};
+    // 00FB-00FF
+    static void *const super[5] = {&&do_00FB, &&do_00FC, &&do_00FD, &&do_00FE, &&do_00FF};
+    static void *const arithmetic[16] = {
+            &&do_8XY0, &&do_8XY1, &&do_8XY2, &&do_8XY3, &&do_8XY4, &&do_8XY5, &&do_8XY6, &&do_8XY7,
+            &&do_unknown, &&do_unknown, &&do_unknown, &&do_unknown, &&do_unknown, &&do_unknown, &&do_8XYE, &&do_unknown};
+
+    uint64_t executed = 0;
+    Instruction instruction;
+    DecodedOp *op = nullptr;
+    void *label = nullptr;
+
+#define DISPATCH()                                  \
+    if (executed == cycles || shutdown) {           \
+        return executed;                            \
+    }                                               \
+    ++executed;                                     \
+    if (PC >= 4096) {                               \
+        shutdown = 1;                               \
+        return executed;                            \
+    }                                               \
+    op = (PC & 1) ? nullptr : &_decoded[PC >> 1];   \
+    if (op && op->label) {                          \
+        instruction = op->instruction;              \
+        PC += 2;                                    \
+        goto *op->label;                            \
+    }                                               \
+    goto do_decode
+
+    DISPATCH();
+
+do_decode:
+    if (!op) {
+        // odd addresses are not cached
+        instruction = fetch();
+    } else {
+        if (!op->handler) {
+            *op = predecode(PC);
+        }
+        instruction = op->instruction;
+        PC += 2;
+    }
     switch (instruction.FN()) {
-        case 0: op_0RRR(instruction); break;
-        case 1: op_1NNN(instruction); break;
-        case 2: op_2NNN(instruction); break;
-        case 3: op_3XNN(instruction); break;
-        case 4: op_4XNN(instruction); break;
-        case 5: op_5XY0(instruction); break;
-        case 6: op_6XNN(instruction); break;
-        case 7: op_7XNN(instruction); break;
-        case 8: op_8XYR(instruction); break;
-        case 9: op_9XY0(instruction); break;
-        case 0xA: op_ANNN(instruction); break;
-        case 0xB: op_BNNN(instruction); break;
-        case 0xC: op_CXNN(instruction); break;
-        case 0xD: op_DXYN(instruction); break;
-        case 0xE: op_EXRR(instruction); break;
-        case 0xF: op_FXRR(instruction); break;
-        default: printf("Unknown instruction: 0x%X\n", instruction.value); break;
-    }
-}
-
-bool Chip8::init() {
-    if (!display.init())
+        case 0:
+            if (instruction.value == 0x00E0) {
+                label = &&do_00E0;
+            } else if (instruction.value == 0x00EE) {
+                label = &&do_00EE;
+            } else if (quirks_of(P).hires && (instruction.value & 0xFFF0) == 0x00C0) {
+                label = &&do_00CN;
+            } else if (quirks_of(P).hires && instruction.value >= 0x00FB && instruction.value <= 0x00FF) {
+                label = super[instruction.value - 0x00FB];
+            } else if (quirks_of(P).xo && (instruction.value & 0xFFF0) == 0x00D0) {
+                label = &&do_00DN;
+            } else {
+                label = &&do_0NNN;
+            }
+            break;
+        case 5:
+            if (quirks_of(P).xo && instruction.N() == 2) {
+                label = &&do_5XY2;
+            } else if (quirks_of(P).xo && instruction.N() == 3) {
+                label = &&do_5XY3;
+            } else {
+                label = &&do_5XY0;
+            }
+            break;
+        case 8: label = arithmetic[instruction.N()]; break;
+        case 0xD: label = quirks_of(P).hires && !instruction.N() ? &&do_DXY0 : &&do_DXYN; break;
+        case 0xE:
+            switch (instruction.NN()) {
+                case 0x9E: label = &&do_EX9E; break;
+                case 0xA1: label = &&do_EXA1; break;
+                default: label = &&do_unknown; break;
+            }
+            break;
+        case 0xF:
+            switch (instruction.NN()) {
+                case 0x00: label = quirks_of(P).xo && instruction.value == 0xF000 ? &&do_F000 : &&do_unknown; break;
+                case 0x01: label = quirks_of(P).xo ? &&do_FN01 : &&do_unknown; break;
+                case 0x02: label = quirks_of(P).xo && instruction.value == 0xF002 ? &&do_F002 : &&do_unknown; break;
+                case 0x07: label = &&do_FX07; break;
+                case 0x0A: label = &&do_FX0A; break;
+                case 0x15: label = &&do_FX15; break;
+                case 0x18: label = &&do_FX18; break;
+                case 0x1E: label = &&do_FX1E; break;
+                case 0x29: label = &&do_FX29; break;
+                case 0x30: label = quirks_of(P).hires ? &&do_FX30 : &&do_unknown; break;
+                case 0x33: label = &&do_FX33; break;
+                case 0x55: label = &&do_FX55; break;
+                case 0x65: label = &&do_FX65; break;
+                default: label = &&do_unknown; break;
+            }
+            break;
+        default: label = families[instruction.FN()]; break;
+    }
+    if (op) {
+        op->label = label;
+    }
+    goto *label;
+
+do_00E0: op_00E0(instruction); DISPATCH();
+do_00EE: op_00EE(instruction); DISPATCH();
+do_0NNN: op_0NNN(instruction); DISPATCH();
+do_00CN: op_00CN(instruction); DISPATCH();
+do_00FB: op_00FB(instruction); DISPATCH();
+do_00FC: op_00FC(instruction); DISPATCH();
+do_00FD: op_00FD(instruction); DISPATCH();
+do_00FE: op_00FE(instruction); DISPATCH();
+do_00FF: op_00FF(instruction); DISPATCH();
+do_00DN: op_00DN(instruction); DISPATCH();
+do_1NNN: op_1NNN(instruction); DISPATCH();
+do_2NNN: op_2NNN(instruction); DISPATCH();
+do_3XNN: op_3XNN<A, DynamicRegs>(instruction); DISPATCH();
+do_4XNN: op_4XNN<A, DynamicRegs>(instruction); DISPATCH();
+do_5XY0: op_5XY0<A, DynamicRegs>(instruction); DISPATCH();
+do_5XY2: op_5XY2<DynamicRegs>(instruction); DISPATCH();
+do_5XY3: op_5XY3<DynamicRegs>(instruction); DISPATCH();
+do_6XNN: op_6XNN<DynamicRegs>(instruction); DISPATCH();
+do_7XNN: op_7XNN<DynamicRegs>(instruction); DISPATCH();
+do_8XY0: op_8XY0<DynamicRegs>(instruction); DISPATCH();
+do_8XY1: op_8XY1<DynamicRegs>(instruction); DISPATCH();
+do_8XY2: op_8XY2<DynamicRegs>(instruction); DISPATCH();
+do_8XY3: op_8XY3<DynamicRegs>(instruction); DISPATCH();
+do_8XY4: op_8XY4<DynamicRegs>(instruction); DISPATCH();
+do_8XY5: op_8XY5<DynamicRegs>(instruction); DISPATCH();
+do_8XY6: op_8XY6<P, DynamicRegs>(instruction); DISPATCH();
+do_8XY7: op_8XY7<DynamicRegs>(instruction); DISPATCH();
+do_8XYE: op_8XYE<P, DynamicRegs>(instruction); DISPATCH();
+do_9XY0: op_9XY0<A, DynamicRegs>(instruction); DISPATCH();
+do_ANNN: op_ANNN(instruction); DISPATCH();
+do_BNNN: op_BNNN<P>(instruction); DISPATCH();
+do_CXNN: op_CXNN<DynamicRegs>(instruction); DISPATCH();
+do_DXYN: op_DXYN<A, DynamicRegs>(instruction); DISPATCH();
+do_DXY0: op_DXY0<A, DynamicRegs>(instruction); DISPATCH();
+do_EX9E: op_EX9E<A, DynamicRegs>(instruction); DISPATCH();
+do_EXA1: op_EXA1<A, DynamicRegs>(instruction); DISPATCH();
+do_FX07: op_FX07<DynamicRegs>(instruction); DISPATCH();
+do_FX0A: op_FX0A(instruction); return executed;
+do_FX15: op_FX15<DynamicRegs>(instruction); DISPATCH();
+do_FX18: op_FX18<DynamicRegs>(instruction); DISPATCH();
+do_FX1E: op_FX1E<A, DynamicRegs>(instruction); DISPATCH();
+do_FX29: op_FX29<DynamicRegs>(instruction); DISPATCH();
+do_FX30: op_FX30<DynamicRegs>(instruction); DISPATCH();
+do_FX33: op_FX33<A, DynamicRegs>(instruction); DISPATCH();
+do_FX55: op_FX55<P, DynamicRegs>(instruction); DISPATCH();
+do_FX65: op_FX65<P, DynamicRegs>(instruction); DISPATCH();
+do_F000: op_F000(instruction); DISPATCH();
+do_FN01: op_FN01(instruction); DISPATCH();
+do_F002: op_F002(instruction); DISPATCH();
+do_unknown: op_unknown(instruction); DISPATCH();
+
+#undef DISPATCH
+}
+#else
+template<Profile P>
+uint64_t Chip8::run_threaded(uint64_t cycles) {
+    return 0;
+}
+#endif
+
+bool Chip8::init(bool headless) {
+    if (!display.init(headless))
         return false;
 
     init_font();
 
-    PC = 0x200;
+    PC = PROGRAM_START;
 
     return true;
 }
 
-void Chip8::op_0RRR(Instruction instruction) {
-    // NOTE: R - means any value (N is taken)
+void Chip8::op_00E0(Instruction) {
+    /* Clear screen */
+    display.clear();
+}
+
+void Chip8::op_00EE(Instruction) {
+    /* Return from subroutine */
+    PC = stack.pop();
+}
+
+void Chip8::op_0NNN(Instruction) {
     // NOTE: 0NNN is not supported
-    if (instruction.value == 0x00E0) {
-        /* Clear screen */
-        display.clear();
-    } else if (instruction.value == 0x00EE) {
-        /* Return from subroutine */
-        PC = stack.pop();
-    }
+}
+
+void Chip8::op_00CN(Instruction instruction) {
+    /* Scroll down N rows */
+    display.scroll_down(instruction.N());
+}
+
+void Chip8::op_00FB(Instruction) {
+    /* Scroll right 4 pixels */
+    display.scroll_right(4);
+}
+
+void Chip8::op_00FC(Instruction) {
+    /* Scroll left 4 pixels */
+    display.scroll_left(4);
+}
+
+void Chip8::op_00FD(Instruction) {
+    /* Exit */
+    shutdown = 1;
+}
+
+void Chip8::op_00FE(Instruction) {
+    /* Low resolution */
+    display.resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+}
+
+void Chip8::op_00FF(Instruction) {
+    /* High resolution */
+    display.resize(display::Display::MAX_WIDTH, display::Display::MAX_HEIGHT);
+}
+
+void Chip8::op_00DN(Instruction instruction) {
+    /* Scroll up N rows */
+    display.scroll_up(instruction.N());
 }
 
 void Chip8::op_1NNN(Instruction instruction) {
@@ -105,14 +815,16 @@ void Chip8::op_1NNN(Instruction instruction) {
     PC = instruction.NNN();
 }
 
+template<typename R>
 void Chip8::op_6XNN(Instruction instruction) {
     /* Set */
-    V[instruction.X()] = instruction.NN();
+    V[R::x(instruction)] = instruction.NN();
 }
 
+template<typename R>
 void Chip8::op_7XNN(Instruction instruction) {
     /* Add */
-    V[instruction.X()] += instruction.NN();
+    V[R::x(instruction)] += instruction.NN();
 }
 
 void Chip8::op_ANNN(Instruction instruction) {
@@ -120,29 +832,68 @@ void Chip8::op_ANNN(Instruction instruction) {
     I = instruction.NNN();
 }
 
+template<Profile P, typename R>
 void Chip8::op_DXYN(Instruction instruction) {
     /* Display */
-    auto x = V[instruction.X()] % display.width;
-    auto y = V[instruction.Y()] % display.height;
-    V[0xF] = 0;
+    CHIP8_PROFILE_SCOPE(profiling.dxyn);
+    if constexpr (quirks_of(P).xo) {
+        draw_planes(V[R::x(instruction)], V[R::y(instruction)], instruction.N(), false);
+        return;
+    }
+    auto x = V[R::x(instruction)] % display.width;
+    auto y = V[R::y(instruction)] % display.height;
+    int top = y;
+    uint64_t collision = 0;
 
     for (int row = 0; row < instruction.N() && y < display.height; ++row, ++y) {
-        auto byte = memory[I + row];
-        for (int bit = 7, cur_x = x; bit >= 0 && cur_x < display.width; --bit, ++cur_x) {
-            bool pixel_on = (byte & (1 << bit));
-            auto pixel_index = cur_x + y * display.width;
-            auto &pixel = display.pixels[pixel_index];
-            if (pixel_on && pixel.is_on()) {
-                pixel.set_off();
-                V[0xF] = 1;
-            } else if (pixel_on && !pixel.is_on()) {
-                pixel.set_on();
+        collision |= display.blit(0, y, x, (uint64_t) ram<P>(I + row) << 56);
+    }
+    V[0xF] = collision ? 1 : 0;
+    // presented once per frame by the caller, see Display::present()
+    display.touch(top, y - top);
+}
+
+template<Profile P, typename R>
+void Chip8::op_DXY0(Instruction instruction) {
+    /* Display 16x16 sprite, two bytes per row */
+    CHIP8_PROFILE_SCOPE(profiling.dxyn);
+    if constexpr (quirks_of(P).xo) {
+        draw_planes(V[R::x(instruction)], V[R::y(instruction)], 16, true);
+        return;
+    }
+    auto x = V[R::x(instruction)] % display.width;
+    auto y = V[R::y(instruction)] % display.height;
+    int top = y;
+    uint64_t collision = 0;
+
+    for (int row = 0; row < 16 && y < display.height; ++row, ++y) {
+        uint64_t bits = (memory[(I + 2 * row) & 0xFFF] << 8) | memory[(I + 2 * row + 1) & 0xFFF];
+        collision |= display.blit(0, y, x, bits << 48);
+    }
+    V[0xF] = collision ? 1 : 0;
+    display.touch(top, y - top);
+}
+
+void Chip8::draw_planes(int x, int y, int height, bool wide) {
+    // the sprite of the second selected plane follows the one of the first
+    x %= display.width;
+    y %= display.height;
+    uint32_t address = I;
+    uint64_t collision = 0;
+    for (int plane = 0; plane < display::Display::PLANES; ++plane) {
+        if (!(display.selected & (1 << plane))) {
+            continue;
+        }
+        for (int row = 0; row < height; ++row) {
+            uint64_t bits = (uint64_t) ram<Profile::XoChip>(address++) << 56;
+            if (wide) {
+                bits |= (uint64_t) ram<Profile::XoChip>(address++) << 48;
             }
+            collision |= display.blit_wrap(plane, (y + row) % display.height, x, bits);
+            display.touch((y + row) % display.height, 1);
         }
     }
-
-    // TODO: should we draw here or in seperate thread at 60Hz ??
-    display.draw();
+    V[0xF] = collision ? 1 : 0;
 }
 
 void Chip8::op_2NNN(Instruction instruction) {
@@ -151,149 +902,293 @@ void Chip8::op_2NNN(Instruction instruction) {
     PC = instruction.NNN();
 }
 
+template<Profile P, typename R>
 void Chip8::op_3XNN(Instruction instruction) {
     /* Skip if equal */
-    if (V[instruction.X()] == instruction.NN()) {
-        PC += 2;
+    if (V[R::x(instruction)] == instruction.NN()) {
+        skip_next<P>();
     }
 }
 
+template<Profile P, typename R>
 void Chip8::op_4XNN(Instruction instruction) {
     /* Skip if not equal */
-    if (V[instruction.X()] != instruction.NN()) {
-        PC += 2;
+    if (V[R::x(instruction)] != instruction.NN()) {
+        skip_next<P>();
     }
 }
 
+template<Profile P, typename R>
 void Chip8::op_5XY0(Instruction instruction) {
     /* Skip if VX == VY */
-    if (V[instruction.X()] == V[instruction.Y()]) {
-        PC += 2;
+    if (V[R::x(instruction)] == V[R::y(instruction)]) {
+        skip_next<P>();
     }
 }
 
+template<Profile P, typename R>
 void Chip8::op_9XY0(Instruction instruction) {
     /* Skip if VX != VY */
-    if (V[instruction.X()] != V[instruction.Y()]) {
-        PC += 2;
+    if (V[R::x(instruction)] != V[R::y(instruction)]) {
+        skip_next<P>();
     }
 }
 
-// FIXME: configurable for 8XY6 & 8XYE operations ( not its original implementation )
-void Chip8::op_8XYR(Instruction instruction) {
-    /* Arithmetic instructions */
-    uint16_t tmp = 0;
-    switch (instruction.N()) {
-        case 0: V[instruction.X()] = V[instruction.Y()]; break;
-        case 1: V[instruction.X()] |= V[instruction.Y()]; break;
-        case 2: V[instruction.X()] &= V[instruction.Y()]; break;
-        case 3: V[instruction.X()] ^= V[instruction.Y()]; break;
-        case 4:
-            tmp = V[instruction.X()];
-            V[instruction.X()] += V[instruction.Y()];
-            V[0xF] = tmp > V[instruction.X()] ? 1 : 0;
-            break;
-        case 5:
-            V[0xF] = V[instruction.X()] > V[instruction.Y()] ? 1 : 0;
-            V[instruction.X()] -= V[instruction.Y()];
-            break;
-        case 7:
-            V[0xF] = V[instruction.Y()] > V[instruction.X()] ? 1 : 0;
-            V[instruction.X()] = V[instruction.Y()] - V[instruction.X()];
-            break;
-        case 6:
-//            V[instruction.X()] = V[instruction.Y()];
-            V[0xF] = V[instruction.X()] & 1;
-            V[instruction.X()] >>= 1;
-            break;
-        case 0xE:
-//            V[instruction.X()] = V[instruction.Y()];
-            V[0xF] = (V[instruction.X()] >> 7) & 1;
-            V[instruction.X()] <<= 1;
-            break;
-        default: printf("Unknown instruction: 0x%X\n", instruction.value); break;
+/* Arithmetic instructions */
+template<typename R>
+void Chip8::op_8XY0(Instruction instruction) {
+    V[R::x(instruction)] = V[R::y(instruction)];
+}
+
+template<typename R>
+void Chip8::op_8XY1(Instruction instruction) {
+    V[R::x(instruction)] |= V[R::y(instruction)];
+}
+
+template<typename R>
+void Chip8::op_8XY2(Instruction instruction) {
+    V[R::x(instruction)] &= V[R::y(instruction)];
+}
+
+template<typename R>
+void Chip8::op_8XY3(Instruction instruction) {
+    V[R::x(instruction)] ^= V[R::y(instruction)];
+}
+
+template<typename R>
+void Chip8::op_8XY4(Instruction instruction) {
+    uint16_t tmp = V[R::x(instruction)];
+    V[R::x(instruction)] += V[R::y(instruction)];
+    V[0xF] = tmp > V[R::x(instruction)] ? 1 : 0;
+}
+
+template<typename R>
+void Chip8::op_8XY5(Instruction instruction) {
+    V[0xF] = V[R::x(instruction)] > V[R::y(instruction)] ? 1 : 0;
+    V[R::x(instruction)] -= V[R::y(instruction)];
+}
+
+template<Profile P, typename R>
+void Chip8::op_8XY6(Instruction instruction) {
+    if constexpr (quirks_of(P).shift_vy) {
+        V[R::x(instruction)] = V[R::y(instruction)];
     }
+    V[0xF] = V[R::x(instruction)] & 1;
+    V[R::x(instruction)] >>= 1;
+}
+
+template<typename R>
+void Chip8::op_8XY7(Instruction instruction) {
+    V[0xF] = V[R::y(instruction)] > V[R::x(instruction)] ? 1 : 0;
+    V[R::x(instruction)] = V[R::y(instruction)] - V[R::x(instruction)];
 }
 
-// FIXME: configurable - original or Chip-48/SUPER-CHIP
+template<Profile P, typename R>
+void Chip8::op_8XYE(Instruction instruction) {
+    if constexpr (quirks_of(P).shift_vy) {
+        V[R::x(instruction)] = V[R::y(instruction)];
+    }
+    V[0xF] = (V[R::x(instruction)] >> 7) & 1;
+    V[R::x(instruction)] <<= 1;
+}
+
+template<Profile P>
 void Chip8::op_BNNN(Instruction instruction) {
     /* Jump with offset */
-    PC = instruction.NNN() + V[0];
+    if constexpr (quirks_of(P).jump_vx) {
+        PC = instruction.NNN() + V[instruction.X()];
+    } else {
+        PC = instruction.NNN() + V[0];
+    }
 }
 
+template<typename R>
 void Chip8::op_CXNN(Instruction instruction) {
     /* Random */
-    V[instruction.X()] = rand() & instruction.NN();
+    V[R::x(instruction)] = xorshift32(_rng) & instruction.NN();
 }
 
-void Chip8::op_EXRR(Instruction instruction) {
-    /* Skip if key */
-    const Uint8 *state = SDL_GetKeyboardState(nullptr);
-    switch (instruction.NN()) {
-        case 0x9E:
-            // if key in VX(0-F) is pressed, inc PC by 2
-            if (state[scancodes[V[instruction.X()]]]) {
-                PC += 2;
-            }
-            break;
-        case 0xA1:
-            // if key in VX(0-F) is not pressed, inc PC by 2
-            if (!state[scancodes[V[instruction.X()]]]) {
-                PC += 2;
-            }
-            break;
-        default: printf("Unknown instruction: 0x%X\n", instruction.value); break;
+/* Skip if key */
+template<Profile P, typename R>
+void Chip8::op_EX9E(Instruction instruction) {
+    // if key in VX(0-F) is pressed, inc PC by 2
+    if ((keys.load(std::memory_order_relaxed) >> (V[R::x(instruction)] & 0xF)) & 1) {
+        skip_next<P>();
     }
 }
 
-// FIXME: add configurable FX55 & FX65 ( now modern implemented )
-void Chip8::op_FXRR(Instruction instruction) {
-    uint16_t temp = 0;
-    switch (instruction.NN()) {
-        case 0x07: // Set VX to the current value of delay timer
-            V[instruction.X()] = delay_timer.get();
-            break;
-        case 0x15: // Set the delay timer to the value in VX
-            delay_timer.set(V[instruction.X()]);
-            break;
-        case 0x18: // Set the sound timer to the value in VX
-            sound_timer.set(V[instruction.X()]);
-            break;
-        case 0x1E: // Add to index
-            I += V[instruction.X()];
-            V[0xF] = I >= 0x1000 ? 1 : 0; // like Amiga interpreter
-            break;
-        case 0x0A: // Get key (blocking)
-            // get which key was pressed and released and save it in VX (BLOCK)
-            break;
-        case 0x29: // Font character
-            I = 0x50 + V[instruction.X()] * 5;
-            break;
-        case 0x33: // Binary-coded decimal conversion
-            memory[I] = V[instruction.X()] / 100;
-            memory[I + 1] = (V[instruction.X()] / 10) % 10;
-            memory[I + 2] = V[instruction.X()] % 10;
-            break;
-        case 0x55: // Store registers to memory
-            temp = V[instruction.X()];
-            for (int i = 0; i <= temp && i < 15; ++i) {
-                memory[I + i] = V[i];
-//                memory[I] = V[i];
-//                ++I;
-            }
-            break;
-        case 0x65: // Load registers from memory
-            temp = V[instruction.X()];
-            for (int i = 0; i <= temp && i < 15; ++i) {
-                V[i] = memory[I + i];
-//               V[i] = memory[I];
-//               ++I;
-            }
-            break;
-        default: printf("Unknown instruction: 0x%X\n", instruction.value); break;
+template<Profile P, typename R>
+void Chip8::op_EXA1(Instruction instruction) {
+    // if key in VX(0-F) is not pressed, inc PC by 2
+    if (!((keys.load(std::memory_order_relaxed) >> (V[R::x(instruction)] & 0xF)) & 1)) {
+        skip_next<P>();
+    }
+}
+
+template<typename R>
+void Chip8::op_FX07(Instruction instruction) {
+    // Set VX to the current value of delay timer
+    V[R::x(instruction)] = delay_timer.get();
+}
+
+template<typename R>
+void Chip8::op_FX15(Instruction instruction) {
+    // Set the delay timer to the value in VX
+    delay_timer.set(V[R::x(instruction)]);
+}
+
+template<typename R>
+void Chip8::op_FX18(Instruction instruction) {
+    // Set the sound timer to the value in VX
+    sound_timer.set(V[R::x(instruction)]);
+    if (beeper) {
+        beeper->tone(V[R::x(instruction)]);
+    }
+}
+
+template<Profile P, typename R>
+void Chip8::op_FX1E(Instruction instruction) {
+    // Add to index
+    I += V[R::x(instruction)];
+    if constexpr (!quirks_of(P).xo) {
+        V[0xF] = I >= 0x1000 ? 1 : 0; // like Amiga interpreter
+    }
+}
+
+void Chip8::op_FX0A(Instruction instruction) {
+    // Get key (blocking)
+    // the backend stops, run() stores the key in VX once it is pressed and released
+    key_wait.start(instruction.x, keys.load(std::memory_order_relaxed));
+}
+
+template<typename R>
+void Chip8::op_FX29(Instruction instruction) {
+    // Font character
+    I = FONT_START + V[R::x(instruction)] * 5;
+}
+
+template<typename R>
+void Chip8::op_FX30(Instruction instruction) {
+    // Big font character
+    I = BIG_FONT_START + V[R::x(instruction)] * 10;
+}
+
+template<Profile P, typename R>
+void Chip8::op_FX33(Instruction instruction) {
+    // Binary-coded decimal conversion
+    ram<P>(I) = V[R::x(instruction)] / 100;
+    ram<P>(I + 1) = (V[R::x(instruction)] / 10) % 10;
+    ram<P>(I + 2) = V[R::x(instruction)] % 10;
+    invalidate_ram<P>(I, 3);
+}
+
+template<Profile P, typename R>
+void Chip8::op_FX55(Instruction instruction) {
+    // Store registers V0..VX to memory
+    int x = R::x(instruction);
+    for (int i = 0; i <= x; ++i) {
+        ram<P>(I + i) = V[i];
+    }
+    invalidate_ram<P>(I, x + 1);
+    advance_index<P>(x);
+}
+
+template<Profile P, typename R>
+void Chip8::op_FX65(Instruction instruction) {
+    // Load registers V0..VX from memory
+    int x = R::x(instruction);
+    for (int i = 0; i <= x; ++i) {
+        V[i] = ram<P>(I + i);
     }
+    advance_index<P>(x);
 }
 
+template<Profile P>
+void Chip8::advance_index(int x) {
+    if constexpr (quirks_of(P).load_store == Quirks::Index::PlusX1) {
+        I += x + 1;
+    } else if constexpr (quirks_of(P).load_store == Quirks::Index::PlusX) {
+        I += x;
+    }
+}
+
+template<Profile P>
+void Chip8::skip_next() {
+    if constexpr (quirks_of(P).xo) {
+        PC += ram<P>(PC) == 0xF0 && ram<P>(PC + 1) == 0x00 ? 4 : 2;
+    } else {
+        PC += 2;
+    }
+}
+
+/* XO-CHIP instructions */
+template<typename R>
+void Chip8::op_5XY2(Instruction instruction) {
+    // Store VX..VY (VY..VX backwards) to memory, I unchanged
+    int x = R::x(instruction);
+    int y = R::y(instruction);
+    int count = std::abs(y - x) + 1;
+    for (int i = 0; i < count; ++i) {
+        ram<Profile::XoChip>(I + i) = V[x <= y ? x + i : x - i];
+    }
+    invalidate_ram<Profile::XoChip>(I, count);
+}
+
+template<typename R>
+void Chip8::op_5XY3(Instruction instruction) {
+    // Load VX..VY (VY..VX backwards) from memory, I unchanged
+    int x = R::x(instruction);
+    int y = R::y(instruction);
+    int count = std::abs(y - x) + 1;
+    for (int i = 0; i < count; ++i) {
+        V[x <= y ? x + i : x - i] = ram<Profile::XoChip>(I + i);
+    }
+}
+
+void Chip8::op_F000(Instruction) {
+    // Long index, the address is the next 16 bits
+    I = (ram<Profile::XoChip>(PC) << 8) | ram<Profile::XoChip>(PC + 1);
+    PC += 2;
+}
+
+void Chip8::op_FN01(Instruction instruction) {
+    // Select the bitplanes in N
+    display.selected = instruction.X() & ((1 << display::Display::PLANES) - 1);
+}
+
+void Chip8::op_F002(Instruction) {
+    // Load the 16 byte audio pattern
+    for (int i = 0; i < 16; ++i) {
+        audio_pattern[i] = ram<Profile::XoChip>(I + i);
+    }
+    if (beeper) {
+        beeper->pattern(audio_pattern);
+    }
+}
+
+void Chip8::op_unknown(Instruction instruction) {
+    printf("Unknown instruction: 0x%X\n", instruction.value);
+}
+
+
+void KeyWait::start(uint8_t x, uint16_t keys) {
+    this->x = x;
+    ignored = keys;
+    pressed = 0;
+}
+
+int KeyWait::released(uint16_t keys) {
+    uint16_t up = pressed & ~keys;
+    // a key released while ignored counts when pressed again
+    ignored &= keys;
+    pressed |= keys & ~ignored;
+    for (int key = 0; key < 16; ++key) {
+        if ((up >> key) & 1) {
+            return key;
+        }
+    }
+    return -1;
+}
 
 void Stack::push(uint16_t value) {
     stack[index++] = value;
@@ -304,29 +1199,16 @@ uint16_t Stack::pop() {
 }
 
 void Timer::decr() {
-    std::lock_guard<std::mutex> lock(_mutex);
-    if (_value > 0) {
-        _value--;
+    // compare exchange, the core may set() the timer concurrently in TimerMode::Thread
+    uint8_t value = _value.load(std::memory_order_relaxed);
+    while (value > 0 && !_value.compare_exchange_weak(value, value - 1, std::memory_order_relaxed)) {
     }
 }
 
-uint8_t Timer::get() {
-    std::lock_guard<std::mutex> lock(_mutex);
-    return _value;
-}
-
-void Timer::set(uint8_t value) {
-    std::lock_guard<std::mutex> lock(_mutex);
-    _value = value;
-}
-
 void timer_fnc(Chip8 *chip) {
-    using namespace std::chrono_literals;
-
+    FramePacer pacer;
     while (!chip->shutdown) {
-        // TODO: do we need higher resolution than 16ms?
-        std::this_thread::sleep_for(16ms);
-        chip->delay_timer.decr();
-        chip->sound_timer.decr();
+        pacer.wait();
+        chip->tick_timers();
     }
 }
@@ -1,10 +1,31 @@
 #include "display.h"
 
-display::Display::Display(int w, int h) : width(w), height(h) {
-    pixels.resize(w * h);
+#include <algorithm>
+
+// first 32 bit RGB format the renderer takes without converting, ARGB8888 if none
+static uint32_t native_format(SDL_Renderer *renderer) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(renderer, &info) == 0) {
+        for (uint32_t i = 0; i < info.num_texture_formats; ++i) {
+            uint32_t format = info.texture_formats[i];
+            if (!SDL_ISPIXELFORMAT_FOURCC(format) && !SDL_ISPIXELFORMAT_INDEXED(format) &&
+                SDL_BYTESPERPIXEL(format) == 4) {
+                return format;
+            }
+        }
+    }
+    return SDL_PIXELFORMAT_ARGB8888;
 }
 
-bool display::Display::init() {
+display::Display::Display(int w, int h) : width(std::min(w, MAX_WIDTH)), height(std::min(h, MAX_HEIGHT)) {
+}
+
+bool display::Display::init(bool headless) {
+    this->headless = headless;
+    if (headless) {
+        return true;
+    }
+
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         return false;
     }
@@ -20,30 +41,151 @@ bool display::Display::init() {
         return false;
     }
 
-    screen.texture = SDL_CreateTexture(screen.renderer, SDL_PIXELFORMAT_RGB24, SDL_TEXTUREACCESS_STATIC, width, height);
+    // sized for the highest resolution, see resize()
+    uint32_t format = native_format(screen.renderer);
+    screen.texture = SDL_CreateTexture(screen.renderer, format, SDL_TEXTUREACCESS_STREAMING, MAX_WIDTH, MAX_HEIGHT);
     if (!screen.texture) {
         return false;
     }
 
+    SDL_PixelFormat *pixel_format = SDL_AllocFormat(format);
+    if (!pixel_format) {
+        return false;
+    }
+    static constexpr uint8_t levels[] = {0, 255, 170, 85};
+    for (int color = 0; color < 4; ++color) {
+        screen.palette[color] = SDL_MapRGB(pixel_format, levels[color], levels[color], levels[color]);
+    }
+    SDL_FreeFormat(pixel_format);
+
+    // the texture starts out undefined
+    dirty = ALL_ROWS;
     return true;
 }
 
 display::Display::~Display() {
+    if (headless) {
+        return;
+    }
     screen.clean_up();
     SDL_Quit();
 }
 
 void display::Display::draw() {
-    SDL_UpdateTexture(screen.texture, nullptr, &pixels[0], width * sizeof(Pixel));
+    if (headless) {
+        return;
+    }
+    CHIP8_PROFILE_SCOPE(draw_time);
+    // one lock per run of dirty rows, the locked pixels are write only
+    for (int y = 0; y < height;) {
+        if (!((dirty >> y) & 1)) {
+            ++y;
+            continue;
+        }
+        int first = y;
+        while (y < height && ((dirty >> y) & 1)) {
+            ++y;
+        }
+        SDL_Rect rows{0, first, width, y - first};
+        void *pixels;
+        int pitch;
+        if (SDL_LockTexture(screen.texture, &rows, &pixels, &pitch) != 0) {
+            continue;
+        }
+        for (int row = first; row < y; ++row) {
+            auto *out = (uint32_t *) ((uint8_t *) pixels + (row - first) * pitch);
+            for (int x = 0; x < width; ++x) {
+                out[x] = screen.palette[color(x, row)];
+            }
+        }
+        SDL_UnlockTexture(screen.texture);
+    }
+    // the current resolution is scaled to the window
+    SDL_Rect area{0, 0, width, height};
     SDL_RenderClear(screen.renderer);
-    SDL_RenderCopy(screen.renderer, screen.texture, nullptr, nullptr);
+    SDL_RenderCopy(screen.renderer, screen.texture, &area, nullptr);
     SDL_RenderPresent(screen.renderer);
 }
 
-void display::Display::clear() {
-    std::memset(&pixels[0], 0, pixels.size() * sizeof(Pixel));
-    // TODO: replace draw() with clearing of renderer to save the copy
+void display::Display::present() {
+    if (!dirty) {
+        return;
+    }
     draw();
+    dirty = 0;
+}
+
+void display::Display::clear() {
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected & (1 << plane)) {
+            std::memset(rows[plane], 0, sizeof(rows[plane]));
+        }
+    }
+    dirty = ALL_ROWS;
+}
+
+void display::Display::resize(int w, int h) {
+    width = std::min(w, MAX_WIDTH);
+    height = std::min(h, MAX_HEIGHT);
+    std::memset(rows, 0, sizeof(rows));
+    dirty = ALL_ROWS;
+}
+
+void display::Display::scroll_down(int n) {
+    n = std::min(n, height);
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected & (1 << plane)) {
+            auto *lines = rows[plane];
+            std::memmove(lines[n], lines[0], (height - n) * sizeof(lines[0]));
+            std::memset(lines[0], 0, n * sizeof(lines[0]));
+        }
+    }
+    dirty = ALL_ROWS;
+}
+
+void display::Display::scroll_up(int n) {
+    n = std::min(n, height);
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (selected & (1 << plane)) {
+            auto *lines = rows[plane];
+            std::memmove(lines[0], lines[n], (height - n) * sizeof(lines[0]));
+            std::memset(lines[height - n], 0, n * sizeof(lines[0]));
+        }
+    }
+    dirty = ALL_ROWS;
+}
+
+void display::Display::scroll_right(int n) {
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (!(selected & (1 << plane))) {
+            continue;
+        }
+        for (int y = 0; y < height; ++y) {
+            uint64_t *row = rows[plane][y];
+            if (width > 64) {
+                row[1] = (row[1] >> n) | (row[0] << (64 - n));
+            }
+            row[0] >>= n;
+        }
+    }
+    dirty = ALL_ROWS;
+}
+
+void display::Display::scroll_left(int n) {
+    for (int plane = 0; plane < PLANES; ++plane) {
+        if (!(selected & (1 << plane))) {
+            continue;
+        }
+        for (int y = 0; y < height; ++y) {
+            uint64_t *row = rows[plane][y];
+            row[0] <<= n;
+            if (width > 64) {
+                row[0] |= row[1] >> (64 - n);
+                row[1] <<= n;
+            }
+        }
+    }
+    dirty = ALL_ROWS;
 }
 
 void display::Screen::clean_up() {
@@ -0,0 +1,131 @@
+#include "input.h"
+
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace {
+    constexpr char MAGIC[4] = {'C', '8', 'I', 'N'};
+
+    template<typename T>
+    void put(std::vector<uint8_t> &out, T value) {
+        auto bytes = (const uint8_t *) &value;
+        out.insert(out.end(), bytes, bytes + sizeof(T));
+    }
+
+    template<typename T>
+    bool get(const std::vector<uint8_t> &in, size_t &position, T &value) {
+        if (position + sizeof(T) > in.size()) {
+            return false;
+        }
+        std::memcpy(&value, &in[position], sizeof(T));
+        position += sizeof(T);
+        return true;
+    }
+}
+
+void input::Log::record(uint16_t keys) {
+    if (events.empty() ? keys != 0 : keys != events.back().keys) {
+        events.push_back({frames, keys});
+    }
+    ++frames;
+}
+
+bool input::Log::save(const std::string &path) const {
+    // NOTE: assumes a little endian host
+    std::vector<uint8_t> out(MAGIC, MAGIC + sizeof(MAGIC));
+    put<uint32_t>(out, VERSION);
+    put<uint32_t>(out, seed);
+    put<uint32_t>(out, instructions_per_frame);
+    put<uint64_t>(out, frames);
+    put<uint32_t>(out, events.size());
+    uint64_t previous = 0;
+    for (auto &event : events) {
+        uint64_t delta = event.frame - previous;
+        previous = event.frame;
+        do {
+            out.push_back((delta & 0x7F) | (delta > 0x7F ? 0x80 : 0));
+            delta >>= 7;
+        } while (delta);
+        put<uint16_t>(out, event.keys);
+    }
+
+    std::ofstream outputFile(path, std::ios_base::binary);
+    outputFile.write((const char *) out.data(), out.size());
+    return outputFile.good();
+}
+
+bool input::Log::load(const std::string &path) {
+    std::ifstream inputFile(path, std::ios_base::binary);
+    if (!inputFile.is_open()) {
+        return false;
+    }
+    std::vector<uint8_t> in((std::istreambuf_iterator<char>(inputFile)), std::istreambuf_iterator<char>());
+
+    size_t position = sizeof(MAGIC);
+    uint32_t version;
+    uint32_t ipf;
+    uint32_t count;
+    if (in.size() < sizeof(MAGIC) || std::memcmp(in.data(), MAGIC, sizeof(MAGIC)) ||
+        !get(in, position, version) || version != VERSION ||
+        !get(in, position, seed) || !get(in, position, ipf) ||
+        !get(in, position, frames) || !get(in, position, count)) {
+        return false;
+    }
+    instructions_per_frame = ipf;
+
+    events.clear();
+    uint64_t frame = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+        uint64_t delta = 0;
+        uint8_t byte;
+        int shift = 0;
+        do {
+            if (!get(in, position, byte) || shift > 63) {
+                return false;
+            }
+            delta |= (uint64_t) (byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        frame += delta;
+        KeyEvent event{frame, 0};
+        if (!get(in, position, event.keys)) {
+            return false;
+        }
+        events.push_back(event);
+    }
+    return true;
+}
+
+bool input::Keypad::pump() {
+    _tapped = 0;
+    bool open = true;
+    SDL_Event event;
+    while (SDL_PollEvent(&event)) {
+        if (event.type == SDL_QUIT) {
+            open = false;
+        }
+        if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) || event.key.repeat) {
+            continue;
+        }
+        for (int key = 0; key < 16; ++key) {
+            if (event.key.keysym.scancode != scancodes[key]) {
+                continue;
+            }
+            if (event.type == SDL_KEYDOWN) {
+                _down |= 1 << key;
+                _tapped |= 1 << key;
+            } else {
+                _down &= ~(1 << key);
+            }
+        }
+    }
+    return open;
+}
+
+uint16_t input::Player::keys(uint64_t frame) {
+    for (; _next < _events.size() && _events[_next].frame <= frame; ++_next) {
+        _keys = _events[_next].keys;
+    }
+    return _keys;
+}
@@ -0,0 +1,371 @@
+#include "jit.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__))
+#define CHIP8_JIT_X64 1
+#include <sys/mman.h>
+#endif
+
+namespace {
+    constexpr size_t CODE_SIZE = 1 << 20;
+    constexpr int MAX_BLOCK_INSTRUCTIONS = 64;
+    // upper bound of the code emitted for one block (~45 bytes per instruction)
+    constexpr size_t MAX_BLOCK_SIZE = 4096;
+
+    /*
+     * Generated code register usage:
+     *   rbx - Chip8 *
+     *   r12 - remaining instruction budget
+     *   r13 - where to store the budget on exit
+     *   rax - on exit: patchable rel32 of the exit taken, or nullptr
+     */
+    struct Emitter {
+        void u8(uint8_t v) { *p++ = v; }
+        void u16(uint16_t v) { std::memcpy(p, &v, 2); p += 2; }
+        void u32(uint32_t v) { std::memcpy(p, &v, 4); p += 4; }
+        void u64(uint64_t v) { std::memcpy(p, &v, 8); p += 8; }
+        void rel32(const uint8_t *target) { u32(target - (p + 4)); }
+
+        // <opcode> modrm [rbx + disp32]
+        void rbx(uint8_t opcode, uint8_t reg, int32_t disp) {
+            u8(opcode);
+            u8(0x80 | (reg << 3) | 3);
+            u32(disp);
+        }
+        void rbx(uint8_t prefix, uint8_t opcode, uint8_t reg, int32_t disp) {
+            u8(prefix);
+            rbx(opcode, reg, disp);
+        }
+
+        void load_al(int32_t disp) { rbx(0x8A, 0, disp); }                         // mov al, [rbx+disp]
+        void store_al(int32_t disp) { rbx(0x88, 0, disp); }                        // mov [rbx+disp], al
+        void store_cl(int32_t disp) { rbx(0x88, 1, disp); }                        // mov [rbx+disp], cl
+        void store_u8(int32_t disp, uint8_t v) { rbx(0xC6, 0, disp); u8(v); }      // mov byte [rbx+disp], imm8
+        void store_u16(int32_t disp, uint16_t v) { rbx(0x66, 0xC7, 0, disp); u16(v); }
+        void setcc_cl(uint8_t cc) { u8(0x0F); u8(0x90 | cc); u8(0xC1); }          // setcc cl
+        uint8_t *jcc_forward(uint8_t cc) { u8(0x0F); u8(0x80 | cc); u32(0); return p - 4; }
+        void jmp(const uint8_t *target) { u8(0xE9); rel32(target); }
+
+        uint8_t *p;
+    };
+
+    constexpr uint8_t CC_B = 0x2;  // carry
+    constexpr uint8_t CC_AE = 0x3; // no carry
+    constexpr uint8_t CC_E = 0x4;
+    constexpr uint8_t CC_NE = 0x5;
+    constexpr uint8_t CC_A = 0x7;
+    constexpr uint8_t CC_L = 0xC;
+
+    void patch_rel32(uint8_t *site, const uint8_t *target) {
+        int32_t rel = target - (site + 4);
+        std::memcpy(site, &rel, 4);
+    }
+
+    int32_t offset(const Chip8 &chip, const void *field) {
+        return (const uint8_t *) field - (const uint8_t *) &chip;
+    }
+}
+
+jit::Jit::Jit(Chip8 &chip) : _chip(chip) {
+#ifdef CHIP8_JIT_X64
+    void *buffer = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer == MAP_FAILED) {
+        return;
+    }
+    _buffer = (uint8_t *) buffer;
+
+    Emitter e{_buffer};
+    /* uint8_t *enter(Chip8 *chip, uint8_t *code, int64_t *budget) */
+    _enter = (Enter) e.p;
+    e.u8(0x53);                          // push rbx
+    e.u8(0x41); e.u8(0x54);              // push r12
+    e.u8(0x41); e.u8(0x55);              // push r13 (stack is 16 byte aligned now)
+    e.u8(0x48); e.u8(0x89); e.u8(0xFB);  // mov rbx, rdi
+    e.u8(0x4C); e.u8(0x8B); e.u8(0x22);  // mov r12, [rdx]
+    e.u8(0x49); e.u8(0x89); e.u8(0xD5);  // mov r13, rdx
+    e.u8(0xFF); e.u8(0xE6);              // jmp rsi
+
+    _exit = e.p;
+    e.u8(0x4D); e.u8(0x89); e.u8(0x65); e.u8(0x00); // mov [r13], r12
+    e.u8(0x41); e.u8(0x5D);              // pop r13
+    e.u8(0x41); e.u8(0x5C);              // pop r12
+    e.u8(0x5B);                          // pop rbx
+    e.u8(0xC3);                          // ret
+
+    _start = _free = e.p;
+#endif
+}
+
+jit::Jit::~Jit() {
+#ifdef CHIP8_JIT_X64
+    if (_buffer) {
+        munmap(_buffer, CODE_SIZE);
+    }
+#endif
+}
+
+void jit::Jit::flush() {
+    _free = _start;
+    std::memset(_blocks, 0, sizeof(_blocks));
+    std::memset(_covered, 0, sizeof(_covered));
+    _flush = false;
+}
+
+void jit::Jit::invalidate(uint16_t address, uint16_t length) {
+    for (int i = address; i < address + length && i < 4096; ++i) {
+        if (_covered[i]) {
+            // might be executing this code right now, flush once back in run()
+            _flush = true;
+            return;
+        }
+    }
+}
+
+void jit::Jit::execute(Chip8 *chip, const DecodedOp *op) {
+    (chip->*op->handler)(op->instruction);
+}
+
+uint64_t jit::Jit::run(uint64_t cycles) {
+    int64_t budget = cycles;
+    uint8_t *link = nullptr;
+
+    while (budget > 0 && !_chip.shutdown && !_chip.key_wait.waiting()) {
+        if (_flush) {
+            flush();
+            link = nullptr;
+        }
+        uint16_t pc = _chip.PC;
+        if (pc >= 4096 || (pc & 1)) {
+            // out of memory or odd address - leave it to the interpreter
+            _chip.fetch_decode_execute();
+            --budget;
+            link = nullptr;
+            continue;
+        }
+
+        uint8_t *block = _blocks[pc >> 1];
+        if (!block) {
+            if (CODE_SIZE - (_free - _buffer) < MAX_BLOCK_SIZE) {
+                flush();
+                link = nullptr;
+            }
+            block = compile(pc);
+        }
+        if (budget < _lengths[pc >> 1]) {
+            // not enough budget for the whole block, finish instruction by instruction
+            _chip.fetch_decode_execute();
+            --budget;
+            link = nullptr;
+            continue;
+        }
+        if (link) {
+            patch_rel32(link, block);
+        }
+        link = _enter(&_chip, block, &budget);
+    }
+
+    return cycles - budget;
+}
+
+uint8_t *jit::Jit::compile(uint16_t address) {
+    const int32_t pc = offset(_chip, &_chip.PC);
+    const int32_t index = offset(_chip, &_chip.I);
+    auto v = [this](int r) { return offset(_chip, &_chip.V[r]); };
+
+    Emitter e{_free};
+    uint8_t *block = e.p;
+
+    // cmp r12, <count>; jl bail; sub r12, <count>
+    e.u8(0x49); e.u8(0x81); e.u8(0xFC);
+    uint8_t *count_cmp = e.p;
+    e.u32(0);
+    uint8_t *bail = e.jcc_forward(CC_L);
+    e.u8(0x49); e.u8(0x81); e.u8(0xEC);
+    uint8_t *count_sub = e.p;
+    e.u32(0);
+
+    auto exit_dynamic = [&]() {
+        e.u8(0x31); e.u8(0xC0); // xor eax, eax
+        e.jmp(_exit);
+    };
+    auto exit_static = [&](uint16_t target) {
+        e.store_u16(pc, target);
+        e.u8(0x48); e.u8(0x8D); e.u8(0x05); e.u32(1); // lea rax, [rip + 1] -> rel32 of the jmp below
+        e.jmp(_exit);
+    };
+    auto call_handler = [&](uint16_t next, const DecodedOp *op) {
+        // handlers expect PC to already point at the next instruction
+        e.store_u16(pc, next);
+        e.u8(0x48); e.u8(0x89); e.u8(0xDF);            // mov rdi, rbx
+        e.u8(0x48); e.u8(0xBE); e.u64((uintptr_t) op); // mov rsi, op
+        e.u8(0x48); e.u8(0xB8); e.u64((uintptr_t) &Jit::execute);
+        e.u8(0xFF); e.u8(0xD0);                        // call rax
+    };
+    auto skip = [&](uint16_t next, uint8_t cc) {
+        uint8_t *taken = e.jcc_forward(cc);
+        exit_static(next);
+        patch_rel32(taken, e.p);
+        exit_static(next + 2);
+    };
+
+    // XO-CHIP skips depend on the next instruction (F000 NNNN), FX1E leaves VF alone
+    const bool xo = quirks_of(_chip._profile).xo;
+
+    uint32_t count = 0;
+    uint16_t a = address;
+    bool done = false;
+    while (!done) {
+        if (a > 4094 || count == MAX_BLOCK_INSTRUCTIONS) {
+            exit_static(a);
+            break;
+        }
+
+        _ops[a >> 1] = _chip.predecode(a);
+        const DecodedOp *op = &_ops[a >> 1];
+        const auto &in = op->instruction;
+        _covered[a] = _covered[a + 1] = true;
+        ++count;
+        a += 2;
+
+        bool native = true;
+        switch (in.FN()) {
+            case 0x1:
+                exit_static(in.nnn);
+                done = true;
+                break;
+            case 0x2:
+                call_handler(a, op);
+                exit_static(in.nnn);
+                done = true;
+                break;
+            case 0x3:
+            case 0x4:
+                if (xo) {
+                    native = false;
+                    break;
+                }
+                e.rbx(0x80, 7, v(in.x)); // cmp byte [Vx], imm8
+                e.u8(in.nn);
+                skip(a, in.FN() == 0x3 ? CC_E : CC_NE);
+                done = true;
+                break;
+            case 0x5:
+            case 0x9:
+                if (xo || in.n != 0) {
+                    native = false;
+                    break;
+                }
+                e.load_al(v(in.x));
+                e.rbx(0x3A, 0, v(in.y)); // cmp al, [Vy]
+                skip(a, in.FN() == 0x5 ? CC_E : CC_NE);
+                done = true;
+                break;
+            case 0x6:
+                e.store_u8(v(in.x), in.nn);
+                break;
+            case 0x7:
+                e.rbx(0x80, 0, v(in.x)); // add byte [Vx], imm8
+                e.u8(in.nn);
+                break;
+            case 0x8:
+                switch (in.n) {
+                    case 0x0:
+                        e.load_al(v(in.y));
+                        e.store_al(v(in.x));
+                        break;
+                    case 0x1:
+                    case 0x2:
+                    case 0x3:
+                        e.load_al(v(in.y));
+                        // or/and/xor [Vx], al
+                        e.rbx(in.n == 0x1 ? 0x08 : in.n == 0x2 ? 0x20 : 0x30, 0, v(in.x));
+                        break;
+                    case 0x4:
+                        e.load_al(v(in.y));
+                        e.rbx(0x00, 0, v(in.x)); // add [Vx], al
+                        e.setcc_cl(CC_B);
+                        e.store_cl(v(0xF));
+                        break;
+                    case 0x5:
+                        e.load_al(v(in.x));
+                        e.rbx(0x3A, 0, v(in.y)); // cmp al, [Vy]
+                        e.setcc_cl(CC_A);
+                        e.store_cl(v(0xF));
+                        e.load_al(v(in.y));
+                        e.rbx(0x28, 0, v(in.x)); // sub [Vx], al
+                        break;
+                    case 0x7:
+                        e.load_al(v(in.y));
+                        e.rbx(0x3A, 0, v(in.x)); // cmp al, [Vx]
+                        e.setcc_cl(CC_A);
+                        e.store_cl(v(0xF));
+                        e.load_al(v(in.y));
+                        e.rbx(0x2A, 0, v(in.x)); // sub al, [Vx]
+                        e.store_al(v(in.x));
+                        break;
+                    case 0x6:
+                        if (quirks_of(_chip._profile).shift_vy) {
+                            e.load_al(v(in.y));
+                            e.store_al(v(in.x));
+                        }
+                        e.load_al(v(in.x));
+                        e.u8(0x24); e.u8(0x01);  // and al, 1
+                        e.store_al(v(0xF));
+                        e.rbx(0xD0, 5, v(in.x)); // shr byte [Vx], 1
+                        break;
+                    case 0xE:
+                        if (quirks_of(_chip._profile).shift_vy) {
+                            e.load_al(v(in.y));
+                            e.store_al(v(in.x));
+                        }
+                        e.load_al(v(in.x));
+                        e.u8(0xC0); e.u8(0xE8); e.u8(0x07); // shr al, 7
+                        e.store_al(v(0xF));
+                        e.rbx(0xD0, 4, v(in.x));            // shl byte [Vx], 1
+                        break;
+                    default: native = false; break;
+                }
+                break;
+            case 0xA:
+                e.store_u16(index, in.nnn);
+                break;
+            case 0xF:
+                if (in.nn == 0x1E && !xo) {
+                    e.rbx(0x0F, 0xB6, 0, v(in.x)); // movzx eax, byte [Vx]
+                    e.rbx(0x66, 0x01, 0, index);   // add [I], ax
+                    e.rbx(0x66, 0x81, 7, index);   // cmp word [I], 0x1000
+                    e.u16(0x1000);
+                    e.setcc_cl(CC_AE);
+                    e.store_cl(v(0xF));
+                } else {
+                    native = false;
+                }
+                break;
+            default: native = false; break;
+        }
+
+        if (!native) {
+            call_handler(a, op);
+            // these may change PC, write into code or stop the program, let run() take over
+            if (in.value == 0x00EE || in.value == 0x00FD || in.FN() == 0xB || in.FN() == 0xE ||
+                (in.FN() == 0xF && (in.nn == 0x0A || in.nn == 0x33 || in.nn == 0x55)) ||
+                in.FN() == 0x3 || in.FN() == 0x4 || in.FN() == 0x5 || in.FN() == 0x9 || in.value == 0xF000) {
+                exit_dynamic();
+                done = true;
+            }
+        }
+    }
+
+    patch_rel32(bail, e.p);
+    e.store_u16(pc, address);
+    exit_dynamic();
+
+    std::memcpy(count_cmp, &count, 4);
+    std::memcpy(count_sub, &count, 4);
+    _blocks[address >> 1] = block;
+    _lengths[address >> 1] = count;
+    _free = e.p;
+
+    return block;
+}
@@ -0,0 +1,597 @@
+#include "lockstep.h"
+#include "font.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#define CHIP8_LOCKSTEP_AVX2 1
+#include <immintrin.h>
+#endif
+
+namespace {
+    enum class Alu {
+        Set, Or, And, Xor, Add, Sub, Shr, SubN, Shl, SetImm, AddImm
+    };
+
+    enum class Cmp {
+        EqImm, NeImm, Eq, Ne
+    };
+
+    /* scalar kernels, same semantics as the Chip8 handlers */
+    void alu_scalar(Alu op, uint8_t *vx, const uint8_t *vy, uint8_t *vf, uint8_t nn, const uint8_t *mask, int n) {
+        for (int l = 0; l < n; ++l) {
+            if (!mask[l]) {
+                continue;
+            }
+            uint8_t tmp = 0;
+            switch (op) {
+                case Alu::Set: vx[l] = vy[l]; break;
+                case Alu::Or: vx[l] |= vy[l]; break;
+                case Alu::And: vx[l] &= vy[l]; break;
+                case Alu::Xor: vx[l] ^= vy[l]; break;
+                case Alu::Add:
+                    tmp = vx[l];
+                    vx[l] += vy[l];
+                    vf[l] = tmp > vx[l] ? 1 : 0;
+                    break;
+                case Alu::Sub:
+                    vf[l] = vx[l] > vy[l] ? 1 : 0;
+                    vx[l] -= vy[l];
+                    break;
+                case Alu::Shr:
+                    vf[l] = vx[l] & 1;
+                    vx[l] >>= 1;
+                    break;
+                case Alu::SubN:
+                    vf[l] = vy[l] > vx[l] ? 1 : 0;
+                    vx[l] = vy[l] - vx[l];
+                    break;
+                case Alu::Shl:
+                    vf[l] = (vx[l] >> 7) & 1;
+                    vx[l] <<= 1;
+                    break;
+                case Alu::SetImm: vx[l] = nn; break;
+                case Alu::AddImm: vx[l] += nn; break;
+            }
+        }
+    }
+
+    void cmp_scalar(Cmp op, const uint8_t *a, const uint8_t *b, uint8_t nn, uint8_t *cond, int n) {
+        for (int l = 0; l < n; ++l) {
+            bool test = false;
+            switch (op) {
+                case Cmp::EqImm: test = a[l] == nn; break;
+                case Cmp::NeImm: test = a[l] != nn; break;
+                case Cmp::Eq: test = a[l] == b[l]; break;
+                case Cmp::Ne: test = a[l] != b[l]; break;
+            }
+            cond[l] = test ? 0xFF : 0;
+        }
+    }
+
+    /*
+     * Marks the lanes at 'pc' with instructions left as executing and
+     * advances them past the instruction. Returns the most instructions any
+     * lane has left afterwards.
+     */
+    int16_t join_scalar(uint16_t pc, uint16_t *PC, int16_t *remaining, uint8_t *mask, uint16_t *mask16, int n) {
+        int16_t most = 0;
+        for (int l = 0; l < n; ++l) {
+            bool join = remaining[l] > 0 && PC[l] == pc;
+            mask[l] = join ? 0xFF : 0;
+            mask16[l] = join ? 0xFFFF : 0;
+            remaining[l] -= join;
+            PC[l] += join ? 2 : 0;
+            most = std::max(most, remaining[l]);
+        }
+        return most;
+    }
+
+    void skip_scalar(uint16_t *PC, const uint8_t *mask, const uint8_t *cond, int n) {
+        for (int l = 0; l < n; ++l) {
+            PC[l] += (mask[l] & cond[l]) ? 2 : 0;
+        }
+    }
+
+    void set_scalar(uint16_t *dst, uint16_t value, const uint16_t *mask16, int n) {
+        for (int l = 0; l < n; ++l) {
+            dst[l] = mask16[l] ? value : dst[l];
+        }
+    }
+
+    // FX1E
+    void add_i_scalar(uint16_t *I, const uint8_t *vx, uint8_t *vf, const uint8_t *mask, int n) {
+        for (int l = 0; l < n; ++l) {
+            if (mask[l]) {
+                I[l] += vx[l];
+                vf[l] = I[l] >= 0x1000 ? 1 : 0;
+            }
+        }
+    }
+
+#ifdef CHIP8_LOCKSTEP_AVX2
+    /*
+     * AVX2 kernels, 32 lanes per iteration. Results are blended into the
+     * registers by lane mask, registers that are written first and read
+     * afterwards (VF may alias VX or VY) are reloaded to match the scalar order.
+     */
+    __attribute__((target("avx2")))
+    inline __m256i load(const void *p) {
+        return _mm256_loadu_si256((const __m256i *) p);
+    }
+
+    __attribute__((target("avx2")))
+    inline void store(void *p, __m256i value, __m256i mask) {
+        _mm256_storeu_si256((__m256i *) p, _mm256_blendv_epi8(load(p), value, mask));
+    }
+
+    __attribute__((target("avx2")))
+    void alu_avx2(Alu op, uint8_t *vx, const uint8_t *vy, uint8_t *vf, uint8_t nn, const uint8_t *mask, int n) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi8(1);
+        const __m256i imm = _mm256_set1_epi8((char) nn);
+        for (int l = 0; l < n; l += lockstep::LANE_BLOCK) {
+            __m256i m = load(mask + l);
+            if (_mm256_testz_si256(m, m)) {
+                continue;
+            }
+            __m256i a = load(vx + l);
+            __m256i b = vy ? load(vy + l) : imm;
+            switch (op) {
+                case Alu::Set: store(vx + l, b, m); break;
+                case Alu::Or: store(vx + l, _mm256_or_si256(a, b), m); break;
+                case Alu::And: store(vx + l, _mm256_and_si256(a, b), m); break;
+                case Alu::Xor: store(vx + l, _mm256_xor_si256(a, b), m); break;
+                case Alu::Add: {
+                    __m256i sum = _mm256_add_epi8(a, b);
+                    // carry if the saturated sum differs from the wrapped one
+                    __m256i carry = _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_adds_epu8(a, b), sum), one);
+                    store(vx + l, sum, m);
+                    store(vf + l, carry, m);
+                    break;
+                }
+                case Alu::Sub:
+                    store(vf + l, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(a, b), zero), one), m);
+                    store(vx + l, _mm256_sub_epi8(load(vx + l), load(vy + l)), m);
+                    break;
+                case Alu::SubN:
+                    store(vf + l, _mm256_andnot_si256(_mm256_cmpeq_epi8(_mm256_subs_epu8(b, a), zero), one), m);
+                    store(vx + l, _mm256_sub_epi8(load(vy + l), load(vx + l)), m);
+                    break;
+                case Alu::Shr:
+                    store(vf + l, _mm256_and_si256(a, one), m);
+                    a = load(vx + l);
+                    store(vx + l, _mm256_and_si256(_mm256_srli_epi16(a, 1), _mm256_set1_epi8(0x7F)), m);
+                    break;
+                case Alu::Shl:
+                    store(vf + l, _mm256_and_si256(_mm256_srli_epi16(a, 7), one), m);
+                    a = load(vx + l);
+                    store(vx + l, _mm256_add_epi8(a, a), m);
+                    break;
+                case Alu::SetImm: store(vx + l, imm, m); break;
+                case Alu::AddImm: store(vx + l, _mm256_add_epi8(a, imm), m); break;
+            }
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void cmp_avx2(Cmp op, const uint8_t *a, const uint8_t *b, uint8_t nn, uint8_t *cond, int n) {
+        const __m256i imm = _mm256_set1_epi8((char) nn);
+        const __m256i ones = _mm256_set1_epi8((char) 0xFF);
+        for (int l = 0; l < n; l += lockstep::LANE_BLOCK) {
+            __m256i eq = _mm256_cmpeq_epi8(load(a + l), b ? load(b + l) : imm);
+            if (op == Cmp::NeImm || op == Cmp::Ne) {
+                eq = _mm256_xor_si256(eq, ones);
+            }
+            _mm256_storeu_si256((__m256i *) (cond + l), eq);
+        }
+    }
+
+    __attribute__((target("avx2")))
+    int16_t join_avx2(uint16_t pc, uint16_t *PC, int16_t *remaining, uint8_t *mask, uint16_t *mask16, int n) {
+        const __m256i target = _mm256_set1_epi16((short) pc);
+        const __m256i zero = _mm256_setzero_si256();
+        __m256i most = zero;
+        for (int l = 0; l < n; l += lockstep::LANE_BLOCK) {
+            __m256i join[2];
+            for (int h = 0; h < 2; ++h) {
+                const int i = l + h * 16;
+                __m256i p = load(PC + i);
+                __m256i r = load(remaining + i);
+                // all ones (-1) in joining lanes
+                __m256i m = _mm256_and_si256(_mm256_cmpeq_epi16(p, target), _mm256_cmpgt_epi16(r, zero));
+                r = _mm256_add_epi16(r, m);
+                p = _mm256_sub_epi16(p, _mm256_add_epi16(m, m));
+                _mm256_storeu_si256((__m256i *) (PC + i), p);
+                _mm256_storeu_si256((__m256i *) (remaining + i), r);
+                _mm256_storeu_si256((__m256i *) (mask16 + i), m);
+                most = _mm256_max_epi16(most, r);
+                join[h] = m;
+            }
+            // packs works per 128 bit half, restore the lane order
+            __m256i bytes = _mm256_permute4x64_epi64(_mm256_packs_epi16(join[0], join[1]), 0xD8);
+            _mm256_storeu_si256((__m256i *) (mask + l), bytes);
+        }
+        __m128i x = _mm_max_epi16(_mm256_castsi256_si128(most), _mm256_extracti128_si256(most, 1));
+        x = _mm_max_epi16(x, _mm_srli_si128(x, 8));
+        x = _mm_max_epi16(x, _mm_srli_si128(x, 4));
+        x = _mm_max_epi16(x, _mm_srli_si128(x, 2));
+        return (int16_t) _mm_extract_epi16(x, 0);
+    }
+
+    __attribute__((target("avx2")))
+    void add_i_avx2(uint16_t *I, const uint8_t *vx, uint8_t *vf, const uint8_t *mask, int n) {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i one = _mm256_set1_epi16(1);
+        for (int l = 0; l < n; l += lockstep::LANE_BLOCK) {
+            __m256i m = load(mask + l);
+            if (_mm256_testz_si256(m, m)) {
+                continue;
+            }
+            __m256i flags[2];
+            for (int h = 0; h < 2; ++h) {
+                const int i = l + h * 16;
+                __m256i sum = _mm256_add_epi16(load(I + i), _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (vx + i))));
+                store(I + i, sum, _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i *) (mask + i))));
+                flags[h] = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_srli_epi16(sum, 12), zero), one);
+            }
+            store(vf + l, _mm256_permute4x64_epi64(_mm256_packus_epi16(flags[0], flags[1]), 0xD8), m);
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void skip_avx2(uint16_t *PC, const uint8_t *mask, const uint8_t *cond, int n) {
+        for (int l = 0; l < n; l += 16) {
+            __m128i c = _mm_and_si128(_mm_loadu_si128((const __m128i *) (mask + l)),
+                                      _mm_loadu_si128((const __m128i *) (cond + l)));
+            __m256i w = _mm256_cvtepi8_epi16(c);
+            _mm256_storeu_si256((__m256i *) (PC + l), _mm256_sub_epi16(load(PC + l), _mm256_add_epi16(w, w)));
+        }
+    }
+
+    __attribute__((target("avx2")))
+    void set_avx2(uint16_t *dst, uint16_t value, const uint16_t *mask16, int n) {
+        const __m256i v = _mm256_set1_epi16((short) value);
+        for (int l = 0; l < n; l += 16) {
+            store(dst + l, v, load(mask16 + l));
+        }
+    }
+#endif
+}
+
+lockstep::Engine::Engine(int lanes)
+    : lanes(lanes), stride((lanes + LANE_BLOCK - 1) / LANE_BLOCK * LANE_BLOCK),
+      V(16 * stride), I(stride), PC(stride), stack(16 * stride), sp(stride),
+      delay_timer(stride), sound_timer(stride), keys(stride), halted(stride), key_wait(stride),
+      memory(4096 * stride), rows(32 * stride), rng(stride),
+      _remaining(stride), _mask(stride), _mask16(stride), _cond(stride) {
+#ifdef CHIP8_LOCKSTEP_AVX2
+    _avx2 = __builtin_cpu_supports("avx2");
+#endif
+}
+
+void lockstep::Engine::use_avx2(bool enable) {
+#ifdef CHIP8_LOCKSTEP_AVX2
+    _avx2 = enable && __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool lockstep::Engine::load_program(const std::string &path) {
+    std::ifstream inputFile(path, std::ios_base::binary | std::ios_base::ate);
+    if (!inputFile.is_open()) {
+        return false;
+    }
+    auto size = (std::streamoff) inputFile.tellg();
+    if (size < 0 || size > MAX_PROGRAM_SIZE) {
+        return false;
+    }
+    std::vector<uint8_t> program(size);
+    inputFile.seekg(0);
+    return inputFile.read((char *) program.data(), size) && load_program(program.data(), size);
+}
+
+bool lockstep::Engine::load_program(const uint8_t *program, size_t size) {
+    if (size > MAX_PROGRAM_SIZE) {
+        return false;
+    }
+
+    std::fill(V.begin(), V.end(), 0);
+    std::fill(I.begin(), I.end(), 0);
+    std::fill(PC.begin(), PC.end(), PROGRAM_START);
+    std::fill(stack.begin(), stack.end(), 0);
+    std::fill(sp.begin(), sp.end(), 0);
+    std::fill(delay_timer.begin(), delay_timer.end(), 0);
+    std::fill(sound_timer.begin(), sound_timer.end(), 0);
+    std::fill(halted.begin(), halted.end(), 0);
+    std::fill(key_wait.begin(), key_wait.end(), KeyWait{});
+    std::fill(rows.begin(), rows.end(), 0);
+    std::memset(_modified, 0, sizeof(_modified));
+    for (int lane = 0; lane < stride; ++lane) {
+        uint8_t *m = mem(lane);
+        std::memset(m, 0, 4096);
+        std::memcpy(&m[FONT_START], font, sizeof(font));
+        std::memcpy(&m[BIG_FONT_START], big_font, sizeof(big_font));
+        std::memcpy(&m[PROGRAM_START], program, size);
+        rng[lane] = lane + 1;
+    }
+
+    return true;
+}
+
+void lockstep::Engine::run_frame(int instructions_per_frame) {
+    // like Chip8::run(), a waiting lane resumes when its key is released
+    for (int l = 0; l < lanes; ++l) {
+        if (key_wait[l].waiting()) {
+            int key = key_wait[l].released(keys[l]);
+            if (key >= 0) {
+                v(key_wait[l].x)[l] = key;
+                key_wait[l].x = -1;
+            }
+        }
+    }
+    // lanes are independent, a long frame can run in chunks that fit _remaining
+    for (int left = instructions_per_frame; left > 0; left -= MAX_CHUNK) {
+        run(std::min(left, MAX_CHUNK));
+    }
+
+    for (int l = 0; l < stride; ++l) {
+        delay_timer[l] -= delay_timer[l] > 0;
+        sound_timer[l] -= sound_timer[l] > 0;
+    }
+}
+
+void lockstep::Engine::run(int instructions) {
+    // 0 if every lane is halted or waiting
+    int16_t most = 0;
+    for (int l = 0; l < stride; ++l) {
+        _remaining[l] = (l < lanes && !halted[l] && !key_wait[l].waiting()) ? instructions : 0;
+        most = std::max(most, _remaining[l]);
+    }
+
+    while (most > 0) {
+        // the lane furthest behind leads, lanes at the same PC join it
+        int leader = 0;
+        while (_remaining[leader] != most) {
+            ++leader;
+        }
+
+        const uint16_t pc = PC[leader];
+        if (pc >= 4096) {
+            most = 0;
+            for (int l = 0; l < lanes; ++l) {
+                if (_remaining[l] > 0 && PC[l] == pc) {
+                    halted[l] = 1;
+                    _remaining[l] = 0;
+                }
+                most = std::max(most, _remaining[l]);
+            }
+            continue;
+        }
+
+        const uint8_t *code = mem(leader);
+        const uint16_t opcode = (code[pc] << 8) | (pc < 4095 ? code[pc + 1] : 0);
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (_avx2) {
+            most = join_avx2(pc, PC.data(), _remaining.data(), _mask.data(), _mask16.data(), stride);
+        } else
+#endif
+        most = join_scalar(pc, PC.data(), _remaining.data(), _mask.data(), _mask16.data(), stride);
+
+        if (_modified[pc] || (pc < 4095 && _modified[pc + 1])) {
+            // the code was written to, it can differ per lane
+            for (int l = 0; l < lanes; ++l) {
+                const uint8_t *own = mem(l);
+                if (_mask[l] && ((own[pc] << 8) | (pc < 4095 ? own[pc + 1] : 0)) != opcode) {
+                    _mask[l] = 0;
+                    _mask16[l] = 0;
+                    PC[l] -= 2;
+                    most = std::max<int16_t>(most, ++_remaining[l]);
+                }
+            }
+        }
+
+        execute(opcode);
+        if ((opcode & 0xF0FF) == 0xF00A) {
+            // FX0A suspends the lanes for the rest of the frame
+            most = 0;
+            for (int l = 0; l < lanes; ++l) {
+                if (_mask[l]) {
+                    _remaining[l] = 0;
+                }
+                most = std::max(most, _remaining[l]);
+            }
+        }
+    }
+}
+
+void lockstep::Engine::skip() {
+#ifdef CHIP8_LOCKSTEP_AVX2
+    if (_avx2) {
+        skip_avx2(PC.data(), _mask.data(), _cond.data(), stride);
+        return;
+    }
+#endif
+    skip_scalar(PC.data(), _mask.data(), _cond.data(), stride);
+}
+
+void lockstep::Engine::execute(uint16_t opcode) {
+    const Instruction in(opcode >> 8, opcode & 0xFF);
+    uint8_t *vx = v(in.x);
+    uint8_t *vy = v(in.y);
+    uint8_t *vf = v(0xF);
+
+    auto alu = [&](Alu op, const uint8_t *src) {
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (_avx2) {
+            alu_avx2(op, vx, src, vf, in.nn, _mask.data(), stride);
+            return;
+        }
+#endif
+        alu_scalar(op, vx, src, vf, in.nn, _mask.data(), stride);
+    };
+    auto cmp = [&](Cmp op, const uint8_t *b) {
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (_avx2) {
+            cmp_avx2(op, vx, b, in.nn, _cond.data(), stride);
+            skip();
+            return;
+        }
+#endif
+        cmp_scalar(op, vx, b, in.nn, _cond.data(), stride);
+        skip();
+    };
+    auto set = [&](std::vector<uint16_t> &dst, uint16_t value) {
+#ifdef CHIP8_LOCKSTEP_AVX2
+        if (_avx2) {
+            set_avx2(dst.data(), value, _mask16.data(), stride);
+            return;
+        }
+#endif
+        set_scalar(dst.data(), value, _mask16.data(), stride);
+    };
+    // everything else is executed lane by lane
+    auto each = [&](auto f) {
+        for (int l = 0; l < stride; ++l) {
+            if (_mask[l]) {
+                f(l);
+            }
+        }
+    };
+    auto write = [&](int l, uint16_t address, uint8_t value) {
+        // NOTE: Chip8 does not bound these either, keep the lane inside its own memory
+        mem(l)[address & 0xFFF] = value;
+        _modified[address & 0xFFF] = true;
+    };
+
+    switch (in.FN()) {
+        case 0x0:
+            if (opcode == 0x00E0) {
+                each([&](int l) { std::memset(&rows[l * 32], 0, 32 * sizeof(uint64_t)); });
+            } else if (opcode == 0x00EE) {
+                each([&](int l) { PC[l] = stack[l * 16 + (--sp[l] & 0xF)]; });
+            }
+            break;
+        case 0x1: set(PC, in.nnn); break;
+        case 0x2:
+            each([&](int l) { stack[l * 16 + (sp[l]++ & 0xF)] = PC[l]; });
+            set(PC, in.nnn);
+            break;
+        case 0x3: cmp(Cmp::EqImm, nullptr); break;
+        case 0x4: cmp(Cmp::NeImm, nullptr); break;
+        case 0x5: cmp(Cmp::Eq, vy); break;
+        case 0x6: alu(Alu::SetImm, nullptr); break;
+        case 0x7: alu(Alu::AddImm, nullptr); break;
+        case 0x8:
+            switch (in.n) {
+                case 0x0: alu(Alu::Set, vy); break;
+                case 0x1: alu(Alu::Or, vy); break;
+                case 0x2: alu(Alu::And, vy); break;
+                case 0x3: alu(Alu::Xor, vy); break;
+                case 0x4: alu(Alu::Add, vy); break;
+                case 0x5: alu(Alu::Sub, vy); break;
+                case 0x6: alu(Alu::Shr, vy); break;
+                case 0x7: alu(Alu::SubN, vy); break;
+                case 0xE: alu(Alu::Shl, vy); break;
+                default: printf("Unknown instruction: 0x%X\n", opcode); break;
+            }
+            break;
+        case 0x9: cmp(Cmp::Ne, vy); break;
+        case 0xA: set(I, in.nnn); break;
+        case 0xB: each([&](int l) { PC[l] = in.nnn + V[l]; }); break;
+        case 0xC: each([&](int l) { vx[l] = xorshift32(rng[l]) & in.nn; }); break;
+        case 0xD:
+            each([&](int l) {
+                const uint8_t *m = mem(l);
+                uint64_t *screen = &rows[l * 32];
+                int x = vx[l] % 64;
+                int y = vy[l] % 32;
+                uint64_t collision = 0;
+                for (int row = 0; row < in.n && y < 32; ++row, ++y) {
+                    uint64_t sprite = ((uint64_t) m[(I[l] + row) & 0xFFF] << 56) >> x;
+                    collision |= screen[y] & sprite;
+                    screen[y] ^= sprite;
+                }
+                vf[l] = collision ? 1 : 0;
+            });
+            break;
+        case 0xE:
+            if (in.nn == 0x9E || in.nn == 0xA1) {
+                each([&](int l) {
+                    bool down = (keys[l] >> (vx[l] & 0xF)) & 1;
+                    _cond[l] = (in.nn == 0x9E) == down ? 0xFF : 0;
+                });
+                skip();
+            } else {
+                printf("Unknown instruction: 0x%X\n", opcode);
+            }
+            break;
+        case 0xF:
+            switch (in.nn) {
+                case 0x07: each([&](int l) { vx[l] = delay_timer[l]; }); break;
+                case 0x0A: each([&](int l) { key_wait[l].start(in.x, keys[l]); }); break;
+                case 0x15: each([&](int l) { delay_timer[l] = vx[l]; }); break;
+                case 0x18: each([&](int l) { sound_timer[l] = vx[l]; }); break;
+                case 0x1E:
+#ifdef CHIP8_LOCKSTEP_AVX2
+                    if (_avx2) {
+                        add_i_avx2(I.data(), vx, vf, _mask.data(), stride);
+                        break;
+                    }
+#endif
+                    add_i_scalar(I.data(), vx, vf, _mask.data(), stride);
+                    break;
+                case 0x29: each([&](int l) { I[l] = FONT_START + vx[l] * 5; }); break;
+                case 0x33:
+                    each([&](int l) {
+                        write(l, I[l], vx[l] / 100);
+                        write(l, I[l] + 1, (vx[l] / 10) % 10);
+                        write(l, I[l] + 2, vx[l] % 10);
+                    });
+                    break;
+                case 0x55:
+                    each([&](int l) {
+                        for (int i = 0; i <= in.x; ++i) {
+                            write(l, I[l] + i, V[i * stride + l]);
+                        }
+                    });
+                    break;
+                case 0x65:
+                    each([&](int l) {
+                        for (int i = 0; i <= in.x; ++i) {
+                            V[i * stride + l] = mem(l)[(I[l] + i) & 0xFFF];
+                        }
+                    });
+                    break;
+                default: printf("Unknown instruction: 0x%X\n", opcode); break;
+            }
+            break;
+        default: break;
+    }
+}
+
+void lockstep::Engine::extract(int lane, Chip8 &chip) const {
+    std::memcpy(chip.memory, &memory[lane * 4096], 4096);
+    chip.invalidate(0, 4096);
+    for (int r = 0; r < 16; ++r) {
+        chip.V[r] = V[r * stride + lane];
+    }
+    chip.I = I[lane];
+    chip.PC = PC[lane];
+    for (int i = 0; i < 16; ++i) {
+        chip.stack.stack[i] = stack[lane * 16 + i];
+    }
+    chip.stack.index = sp[lane];
+    chip.delay_timer.set(delay_timer[lane]);
+    chip.sound_timer.set(sound_timer[lane]);
+    chip.keys = keys[lane];
+    chip.seed(rng[lane]);
+    chip.shutdown = halted[lane];
+    chip.key_wait = key_wait[lane];
+    chip.display.resize(DISPLAY_WIDTH, DISPLAY_HEIGHT);
+    for (int y = 0; y < DISPLAY_HEIGHT; ++y) {
+        chip.display.rows[0][y][0] = rows[lane * 32 + y];
+    }
+}
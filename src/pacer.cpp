@@ -0,0 +1,27 @@
+#include "pacer.h"
+
+#include <thread>
+
+// NOTE: when this far behind (stalled window, debugger) start over instead of catching up
+constexpr int MAX_LAG_FRAMES = 5;
+
+FramePacer::FramePacer(double hz)
+    : period(std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(1.0 / hz))),
+      _start(clock::now()), _next(_start) {
+}
+
+void FramePacer::wait() {
+    ++frames;
+    _next += period;
+    auto now = clock::now();
+    if (now - _next > period * MAX_LAG_FRAMES) {
+        _next = now;
+        return;
+    }
+    std::this_thread::sleep_until(_next);
+}
+
+double FramePacer::rate() const {
+    std::chrono::duration<double> elapsed = clock::now() - _start;
+    return frames / elapsed.count();
+}
@@ -0,0 +1,120 @@
+#include "profiler.h"
+
+#ifdef CHIP8_PROFILE
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+
+// deeper calls are counted in the deepest frame, like the 16 entry stack
+constexpr int MAX_DEPTH = 16;
+constexpr int HOT_ADDRESSES = 20;
+
+namespace {
+    std::string family(uint16_t opcode) {
+        static const char *const arithmetic[16] = {
+                "8XY0", "8XY1", "8XY2", "8XY3", "8XY4", "8XY5", "8XY6", "8XY7",
+                "8XY?", "8XY?", "8XY?", "8XY?", "8XY?", "8XY?", "8XYE", "8XY?"};
+        static const char *const families[16] = {
+                "0NNN", "1NNN", "2NNN", "3XNN", "4XNN", "5XY0", "6XNN", "7XNN",
+                "8XY?", "9XY0", "ANNN", "BNNN", "CXNN", "DXYN", "EX??", "FX??"};
+        char name[5];
+        switch (opcode >> 12) {
+            case 0x0:
+                return opcode == 0x00E0 ? "00E0" : opcode == 0x00EE ? "00EE" : "0NNN";
+            case 0x8:
+                return arithmetic[opcode & 0xF];
+            case 0xE:
+            case 0xF:
+                // keep the low byte: EX9E, FX33, ...
+                snprintf(name, sizeof(name), "%cX%02X", (opcode >> 12) == 0xE ? 'E' : 'F', opcode & 0xFF);
+                return name;
+            default:
+                return families[opcode >> 12];
+        }
+    }
+
+    double percent(uint64_t part, uint64_t total) {
+        return total ? 100.0 * part / total : 0;
+    }
+
+    void print_timing(FILE *out, const char *name, const profiler::Timing &timing) {
+        fprintf(out, "  %-14s %10llu calls %10.3f ms %8.0f ns/call\n", name, (unsigned long long) timing.calls,
+                timing.ns / 1e6, timing.calls ? (double) timing.ns / timing.calls : 0.0);
+    }
+}
+
+profiler::Profiler::Profiler() : _opcodes(0x10000), _addresses(4096), _nodes{{0, 0x200, 0, 0}} {
+}
+
+void profiler::Profiler::call(uint16_t address) {
+    if (_nodes[_node].depth >= MAX_DEPTH) {
+        return;
+    }
+    uint64_t key = (uint64_t) _node << 16 | address;
+    auto child = _children.find(key);
+    if (child == _children.end()) {
+        _nodes.push_back({_node, address, (uint16_t) (_nodes[_node].depth + 1), 0});
+        child = _children.emplace(key, _nodes.size() - 1).first;
+    }
+    _node = child->second;
+}
+
+void profiler::Profiler::report(FILE *out, const Timing &draw) const {
+    uint64_t total = 0;
+    std::map<std::string, uint64_t> by_family;
+    for (int opcode = 0; opcode < 0x10000; ++opcode) {
+        if (_opcodes[opcode]) {
+            by_family[family(opcode)] += _opcodes[opcode];
+            total += _opcodes[opcode];
+        }
+    }
+    std::vector<std::pair<std::string, uint64_t>> families(by_family.begin(), by_family.end());
+    std::sort(families.begin(), families.end(), [](auto &a, auto &b) { return a.second > b.second; });
+
+    std::vector<uint16_t> addresses;
+    for (int address = 0; address < 4096; ++address) {
+        if (_addresses[address]) {
+            addresses.push_back(address);
+        }
+    }
+    std::sort(addresses.begin(), addresses.end(), [this](uint16_t a, uint16_t b) { return _addresses[a] > _addresses[b]; });
+    addresses.resize(std::min<size_t>(addresses.size(), HOT_ADDRESSES));
+
+    fprintf(out, "Profile: %llu instructions\n", (unsigned long long) total);
+    fprintf(out, "Opcode families:\n");
+    for (auto &entry : families) {
+        fprintf(out, "  %-6s %14llu %6.2f%%\n", entry.first.c_str(), (unsigned long long) entry.second,
+                percent(entry.second, total));
+    }
+    fprintf(out, "Hot addresses:\n");
+    for (auto address : addresses) {
+        fprintf(out, "  0x%03X  %14llu %6.2f%%\n", address, (unsigned long long) _addresses[address],
+                percent(_addresses[address], total));
+    }
+    fprintf(out, "Time:\n");
+    print_timing(out, "DXYN", dxyn);
+    print_timing(out, "Display::draw", draw);
+}
+
+bool profiler::Profiler::write_folded(const std::string &path) const {
+    std::ofstream outputFile(path);
+    if (!outputFile.is_open()) {
+        return false;
+    }
+    for (size_t i = 0; i < _nodes.size(); ++i) {
+        if (!_nodes[i].count) {
+            continue;
+        }
+        std::string stack;
+        for (uint32_t node = i; node; node = _nodes[node].parent) {
+            char frame[16];
+            snprintf(frame, sizeof(frame), ";sub_%03X", _nodes[node].address);
+            stack.insert(0, frame);
+        }
+        outputFile << "main" << stack << ' ' << _nodes[i].count << '\n';
+    }
+    return outputFile.good();
+}
+
+#endif
@@ -0,0 +1,165 @@
+#include "rewind.h"
+
+#include <algorithm>
+#include <cstring>
+
+// shorter unchanged runs stay inside the changed bytes, a segment header costs 4 bytes
+constexpr size_t MIN_RUN = 4;
+constexpr size_t HEADER = sizeof(uint32_t);
+// a State followed by the XO-CHIP memory above 4 KB
+constexpr size_t SNAPSHOT = sizeof(State) + sizeof(HighMemory);
+
+RewindBuffer::RewindBuffer(size_t bytes, size_t max_frames)
+    : _buffer(bytes), _max_frames(max_frames), _current(SNAPSHOT), _next(SNAPSHOT), _scratch(2 * SNAPSHOT) {
+}
+
+void RewindBuffer::push(const State &state, const HighMemory *high_memory) {
+    bool high = state.high_memory && high_memory;
+    // the high memory stays zero in snapshots without it and is only compared while one of the two has it
+    size_t size = high || _high ? SNAPSHOT : sizeof(State);
+    std::memcpy(_next.data(), &state, sizeof(State));
+    if (high) {
+        std::memcpy(&_next[sizeof(State)], high_memory->bytes, sizeof(HighMemory));
+    } else if (_high) {
+        std::memset(&_next[sizeof(State)], 0, sizeof(HighMemory));
+    }
+    if (!_valid) {
+        std::memcpy(_current.data(), _next.data(), size);
+        _high = high;
+        _valid = true;
+        return;
+    }
+
+    size_t length = encode(size);
+    std::memcpy(_current.data(), _next.data(), size);
+    _high = high;
+    if (length + 2 * HEADER > _buffer.size() || !_max_frames) {
+        // the previous frames can not be reached anymore
+        _head = _tail = _used = _count = 0;
+        return;
+    }
+    while (_used + length + 2 * HEADER > _buffer.size() || _count >= _max_frames) {
+        drop_oldest();
+    }
+
+    uint32_t header = length;
+    write(&header, HEADER);
+    write(_scratch.data(), length);
+    write(&header, HEADER);
+    _used += length + 2 * HEADER;
+    ++_count;
+}
+
+bool RewindBuffer::pop(State &state, HighMemory *high_memory) {
+    if (!_count) {
+        return false;
+    }
+
+    uint32_t length;
+    size_t size = _buffer.size();
+    read((_head + size - HEADER) % size, &length, HEADER);
+    _head = (_head + size - length - 2 * HEADER) % size;
+    read((_head + HEADER) % size, _scratch.data(), length);
+    decode(length);
+    _used -= length + 2 * HEADER;
+    --_count;
+
+    std::memcpy(&state, _current.data(), sizeof(State));
+    _high = state.high_memory;
+    if (_high && high_memory) {
+        std::memcpy(high_memory->bytes, &_current[sizeof(State)], sizeof(HighMemory));
+    }
+    return true;
+}
+
+void RewindBuffer::clear() {
+    _head = _tail = _used = _count = 0;
+    _valid = false;
+    if (_high) {
+        std::memset(&_current[sizeof(State)], 0, sizeof(HighMemory));
+        _high = false;
+    }
+}
+
+size_t RewindBuffer::encode(size_t size) {
+    const uint8_t *a = _current.data();
+    const uint8_t *b = _next.data();
+    size_t out = 0;
+    size_t i = 0;
+    while (i < size) {
+        size_t start = i;
+        while (i + 8 <= size && !std::memcmp(&a[i], &b[i], 8)) {
+            i += 8;
+        }
+        while (i < size && a[i] == b[i]) {
+            ++i;
+        }
+        if (i == size) {
+            break;
+        }
+        size_t unchanged = i - start;
+        // segment lengths are 16 bit, longer unchanged runs take segments without changed bytes
+        while (unchanged > UINT16_MAX) {
+            uint16_t skip[] = {UINT16_MAX, 0};
+            std::memcpy(&_scratch[out], skip, sizeof(skip));
+            out += 4;
+            unchanged -= UINT16_MAX;
+        }
+
+        // changed bytes end at MIN_RUN unchanged ones
+        size_t first = i;
+        size_t run = 0;
+        while (i < size && run < MIN_RUN && i - first < UINT16_MAX) {
+            run = a[i] == b[i] ? run + 1 : 0;
+            ++i;
+        }
+        i -= run;
+        uint16_t changed = i - first;
+
+        uint16_t lengths[] = {uint16_t(unchanged), changed};
+        std::memcpy(&_scratch[out], lengths, sizeof(lengths));
+        out += 4;
+        for (size_t k = first; k < i; ++k) {
+            _scratch[out++] = a[k] ^ b[k];
+        }
+    }
+    return out;
+}
+
+void RewindBuffer::decode(size_t length) {
+    uint8_t *state = _current.data();
+    size_t offset = 0;
+    size_t in = 0;
+    while (in < length) {
+        uint16_t unchanged;
+        uint16_t changed;
+        std::memcpy(&unchanged, &_scratch[in], sizeof(unchanged));
+        std::memcpy(&changed, &_scratch[in + 2], sizeof(changed));
+        in += 4;
+        offset += unchanged;
+        for (int k = 0; k < changed; ++k) {
+            state[offset++] ^= _scratch[in++];
+        }
+    }
+}
+
+void RewindBuffer::write(const void *data, size_t length) {
+    size_t first = std::min(length, _buffer.size() - _head);
+    std::memcpy(&_buffer[_head], data, first);
+    std::memcpy(&_buffer[0], static_cast<const uint8_t *>(data) + first, length - first);
+    _head = (_head + length) % _buffer.size();
+}
+
+void RewindBuffer::read(size_t position, void *data, size_t length) const {
+    size_t first = std::min(length, _buffer.size() - position);
+    std::memcpy(data, &_buffer[position], first);
+    std::memcpy(static_cast<uint8_t *>(data) + first, &_buffer[0], length - first);
+}
+
+void RewindBuffer::drop_oldest() {
+    uint32_t length;
+    read(_tail, &length, HEADER);
+    _tail = (_tail + length + 2 * HEADER) % _buffer.size();
+    _used -= length + 2 * HEADER;
+    --_count;
+}
@@ -0,0 +1,150 @@
+#include "rom.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+    // instructions only a SUPER-CHIP interpreter knows
+    bool superchip(const Instruction &in) {
+        switch (in.FN()) {
+            case 0x0:
+                return (in.value & 0xFFF0) == 0x00C0 || (in.value >= 0x00FB && in.value <= 0x00FF);
+            case 0xD:
+                return in.n == 0;
+            case 0xF:
+                return in.nn == 0x30 || in.nn == 0x75 || in.nn == 0x85;
+            default:
+                return false;
+        }
+    }
+
+    // instructions only an XO-CHIP interpreter knows
+    bool xochip(const Instruction &in) {
+        switch (in.FN()) {
+            case 0x0:
+                return (in.value & 0xFFF0) == 0x00D0;
+            case 0x5:
+                return in.n == 2 || in.n == 3;
+            case 0xF:
+                return in.value == 0xF000 || in.nn == 0x01 || in.value == 0xF002 || in.nn == 0x3A;
+            default:
+                return false;
+        }
+    }
+
+    bool same(const rom::Analysis &analysis, const uint8_t *program, size_t size) {
+        return analysis.program.size() == size && !std::memcmp(analysis.program.data(), program, size);
+    }
+}
+
+uint64_t rom::hash(const uint8_t *program, size_t size) {
+    uint64_t hash = 0xCBF29CE484222325ull ^ size;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, &program[i], 8);
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 29;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ program[i]) * 0x100000001B3ull;
+    }
+    return hash;
+}
+
+rom::Analysis rom::analyze(const uint8_t *program, size_t size) {
+    Analysis analysis;
+    analysis.hash = hash(program, size);
+    analysis.program.assign(program, program + size);
+
+    const int end = PROGRAM_START + size;
+    auto byte = [&](int address) { return address < end ? program[address - PROGRAM_START] : 0; };
+    // jumps and calls reach the first 4 KB only
+    const int code_end = std::min(end, 4096);
+
+    bool uses_superchip = false;
+    bool uses_xochip = false;
+    std::bitset<4096> visited;
+    std::vector<uint16_t> pending{PROGRAM_START};
+    while (!pending.empty()) {
+        int address = pending.back();
+        pending.pop_back();
+        // follow straight-line code until it ends or joins known code
+        while (address >= PROGRAM_START && address < code_end && !visited[address]) {
+            visited[address] = true;
+            analysis.code[address] = true;
+            if (address + 1 < 4096) {
+                analysis.code[address + 1] = true;
+            }
+            Instruction in(byte(address), byte(address + 1));
+            uses_superchip |= superchip(in);
+            uses_xochip |= xochip(in);
+            int next = address + 2;
+            switch (in.FN()) {
+                case 0x0:
+                    // 00EE returns, 00FD exits
+                    if (in.value == 0x00EE || in.value == 0x00FD) {
+                        next = -1;
+                    }
+                    break;
+                case 0x1: next = in.nnn; break;
+                case 0x2: pending.push_back(in.nnn); break;
+                case 0x3:
+                case 0x4:
+                case 0x5:
+                case 0x9: pending.push_back(next + 2); break;
+                // computed jump, the target is not known statically
+                case 0xB: next = -1; break;
+                case 0xE:
+                    if (in.nn == 0x9E || in.nn == 0xA1) {
+                        pending.push_back(next + 2);
+                    }
+                    break;
+                case 0xF:
+                    // F000 NNNN, the address is data
+                    if (in.value == 0xF000) {
+                        next += 2;
+                    }
+                    break;
+                default: break;
+            }
+            address = next;
+        }
+    }
+
+    if (uses_xochip || size > MAX_PROGRAM_SIZE) {
+        analysis.profile = Profile::XoChip;
+    } else {
+        analysis.profile = uses_superchip ? Profile::SuperChip : Profile::Modern;
+    }
+    return analysis;
+}
+
+std::shared_ptr<const rom::Analysis> rom::Cache::find(const uint8_t *program, size_t size) const {
+    auto key = hash(program, size);
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto range = _entries.equal_range(key);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+        if (same(*entry->second, program, size)) {
+            return entry->second;
+        }
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const rom::Analysis> rom::Cache::insert(std::shared_ptr<const Analysis> analysis) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto range = _entries.equal_range(analysis->hash);
+    for (auto entry = range.first; entry != range.second; ++entry) {
+        if (same(*entry->second, analysis->program.data(), analysis->program.size())) {
+            return entry->second;
+        }
+    }
+    _entries.emplace(analysis->hash, analysis);
+    return analysis;
+}
+
+size_t rom::Cache::size() const {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _entries.size();
+}